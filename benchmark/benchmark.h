@@ -0,0 +1,38 @@
+#ifndef __YOLOV5_PPL_NN_BENCHMARK_H__
+#define __YOLOV5_PPL_NN_BENCHMARK_H__
+/**********************************************************
+* \file benchmark.h
+* \brief Shared result type of the micro and end-to-end benchmarks
+***********************************************************/
+
+#include <string>
+#include <vector>
+
+/**
+* \brief Latency summary of one benchmark case, all times in microseconds
+*/
+struct BenchResult{
+    std::string name;
+    int iterations;
+    double mean_us;
+    double p50_us;
+    double p95_us;
+    double p99_us;
+    double throughput;       ///< iterations per second
+};
+
+/**
+* \brief Summarize per iteration latencies, samples are sorted in place
+*/
+BenchResult summarize(const std::string& name, std::vector<double>& samples_us, const double wall_us);
+
+/**
+* \brief Run the whole detector on one image, appends one result per measured mode
+* \return 0 on success
+*/
+int run_e2e_benchmark(const char* model_path,
+                      const char* image_path,
+                      const int iterations,
+                      std::vector<BenchResult>& results);
+
+#endif
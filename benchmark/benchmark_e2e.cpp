@@ -0,0 +1,100 @@
+#include "benchmark.h"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdio.h>
+
+#include "yolov5.h"
+#include "yolov5_pipeline.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_us(const Clock::time_point& start, const Clock::time_point& end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+int run_e2e_benchmark(const char* model_path,
+                      const char* image_path,
+                      const int iterations,
+                      std::vector<BenchResult>& results) {
+    ModelParams params;
+    params.onnx_path      = model_path;
+    params.num_runtimes   = 3;
+    params.class_agnostic = false;
+    params.pre_nms_topk   = 30000;
+    params.max_det        = 300;
+
+    // init is part of what a cold start pays, warm-up included
+    Clock::time_point init_start = Clock::now();
+    std::unique_ptr<Yolov5Impl> yolov5(new Yolov5Impl(params));
+    if (yolov5->yolov5_network_detect_init() != ppl::common::RC_SUCCESS) {
+        fprintf(stderr, "init %s failed\n", model_path);
+        return -1;
+    }
+    std::vector<double> init_samples(1, elapsed_us(init_start, Clock::now()));
+    results.push_back(summarize("e2e_init", init_samples, init_samples[0]));
+
+    cv::Mat image = cv::imread(image_path);
+    if (image.empty()) {
+        fprintf(stderr, "cannot read %s\n", image_path);
+        return -1;
+    }
+
+    std::vector<DetectRes> detect_res;
+
+    // one frame at a time on the caller's thread
+    {
+        std::vector<double> samples(iterations);
+        Clock::time_point begin = Clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            detect_res.clear();
+            Clock::time_point start = Clock::now();
+            yolov5->yolov5_network_detect(image, detect_res);
+            samples[i] = elapsed_us(start, Clock::now());
+        }
+        results.push_back(summarize("e2e_detect", samples, elapsed_us(begin, Clock::now())));
+    }
+
+    // batches of 4, latency is per batch and throughput per image
+    {
+        std::vector<cv::Mat> batch(4, image);
+        std::vector<std::vector<DetectRes>> batch_res;
+        std::vector<double> samples(iterations / 4 + 1);
+        Clock::time_point begin = Clock::now();
+        for (size_t i = 0; i < samples.size(); ++i) {
+            Clock::time_point start = Clock::now();
+            yolov5->yolov5_network_detect_batch(batch, batch_res);
+            samples[i] = elapsed_us(start, Clock::now());
+        }
+        const double wall_us = elapsed_us(begin, Clock::now());
+        BenchResult result = summarize("e2e_batch4", samples, wall_us);
+        result.throughput = samples.size() * batch.size() * 1e6 / wall_us;
+        results.push_back(result);
+    }
+
+    // overlapping stages, latency is submit to result
+    {
+        std::vector<double> samples(iterations);
+        std::vector<Clock::time_point> submitted(iterations);
+        std::vector<std::future<std::vector<DetectRes>>> futures(iterations);
+        Clock::time_point begin = Clock::now();
+        {
+            Yolov5Pipeline pipeline(yolov5.get());
+            for (int i = 0; i < iterations; ++i) {
+                submitted[i] = Clock::now();
+                futures[i] = pipeline.submit(image);
+            }
+            for (int i = 0; i < iterations; ++i) {
+                futures[i].get();
+                samples[i] = elapsed_us(submitted[i], Clock::now());
+            }
+        }
+        results.push_back(summarize("e2e_pipeline", samples, elapsed_us(begin, Clock::now())));
+    }
+
+    // where the time went, per stage over every run above
+    yolov5->get_stats().print(stderr);
+
+    return 0;
+}
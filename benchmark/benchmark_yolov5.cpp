@@ -0,0 +1,474 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "cpu_isa.h"
+#include "mmcv_nms.h"
+#include "preprocess.h"
+#include "utils.h"
+
+// compiler flags of this build, set by CMakeLists.txt
+#ifndef YOLOV5_BENCHMARK_FLAGS
+#define YOLOV5_BENCHMARK_FLAGS "unknown"
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_us(const Clock::time_point& start, const Clock::time_point& end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+BenchResult summarize(const std::string& name, std::vector<double>& samples_us, const double wall_us) {
+    BenchResult result;
+    result.name = name;
+    result.iterations = samples_us.size();
+    result.mean_us = 0.0;
+    result.p50_us = result.p95_us = result.p99_us = 0.0;
+    result.throughput = 0.0;
+    if (samples_us.empty())
+        return result;
+
+    std::sort(samples_us.begin(), samples_us.end());
+    for (double v : samples_us)
+        result.mean_us += v;
+    result.mean_us /= samples_us.size();
+
+    const size_t last = samples_us.size() - 1;
+    result.p50_us = samples_us[static_cast<size_t>(last * 0.50)];
+    result.p95_us = samples_us[static_cast<size_t>(last * 0.95)];
+    result.p99_us = samples_us[static_cast<size_t>(last * 0.99)];
+    result.throughput = wall_us > 0 ? samples_us.size() * 1e6 / wall_us : 0.0;
+    return result;
+}
+
+template <typename Func>
+static BenchResult measure(const std::string& name, const int iterations, Func func) {
+    func(); // warm caches and lazily sized buffers
+
+    std::vector<double> samples(iterations);
+    Clock::time_point begin = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        Clock::time_point start = Clock::now();
+        func();
+        samples[i] = elapsed_us(start, Clock::now());
+    }
+    return summarize(name, samples, elapsed_us(begin, Clock::now()));
+}
+
+// one raw head [3, grid, grid, 5 + num_classes] where a `density` fraction of cells pass prob_threshold
+static void synthetic_head(const int num_grid, const int num_classes, const float density, std::mt19937& rng,
+                           std::vector<float>& head) {
+    const int offset = num_classes + 5;
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::normal_distribution<float> logit(-6.f, 2.f);
+
+    head.resize(3 * num_grid * num_grid * offset);
+    for (float& v : head)
+        v = logit(rng);
+
+    for (int cell = 0; cell < 3 * num_grid * num_grid; ++cell) {
+        float* p = head.data() + cell * offset;
+        p[0] = uniform(rng) * 4.f - 2.f;
+        p[1] = uniform(rng) * 4.f - 2.f;
+        p[2] = uniform(rng) * 2.f - 1.f;
+        p[3] = uniform(rng) * 2.f - 1.f;
+        if (uniform(rng) < density) {
+            p[4] = 4.f;
+            p[5 + rng() % num_classes] = 4.f;
+        }
+    }
+}
+
+// the same in-graph decoded [num_boxes, 5 + num_classes], probabilities instead of logits
+static void synthetic_fused(const int num_boxes, const int num_classes, const float density, std::mt19937& rng,
+                            std::vector<float>& output) {
+    const int offset = num_classes + 5;
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+    output.resize(num_boxes * offset);
+    for (float& v : output)
+        v = uniform(rng) * 0.05f;
+
+    for (int row = 0; row < num_boxes; ++row) {
+        float* p = output.data() + row * offset;
+        p[0] = uniform(rng) * 640.f;
+        p[1] = uniform(rng) * 640.f;
+        p[2] = uniform(rng) * 160.f;
+        p[3] = uniform(rng) * 160.f;
+        if (uniform(rng) < density) {
+            p[4] = 0.9f;
+            p[5 + rng() % num_classes] = 0.9f;
+        }
+    }
+}
+
+static void bench_decode(const int iterations, std::vector<BenchResult>& results) {
+    const int num_classes = 80;
+    const int num_grids[3] = {80, 40, 20};
+    const int strides[3] = {8, 16, 32};
+    const std::vector<float> anchors[3] = {{10.f, 13.f, 16.f, 30.f, 33.f, 23.f},
+                                           {30.f, 61.f, 62.f, 45.f, 59.f, 119.f},
+                                           {116.f, 90.f, 156.f, 198.f, 373.f, 326.f}};
+    const float densities[] = {0.001f, 0.01f, 0.1f};
+
+    std::mt19937 rng(8);
+    for (float density : densities) {
+        std::vector<float> heads[3];
+        int max_num_proposals = 0;
+        for (int i = 0; i < 3; ++i) {
+            synthetic_head(num_grids[i], num_classes, density, rng, heads[i]);
+            max_num_proposals += 3 * num_grids[i] * num_grids[i];
+        }
+
+        std::vector<float> boxes(max_num_proposals * 4), scores(max_num_proposals);
+        std::vector<int> labels(max_num_proposals);
+
+        char name[64];
+        snprintf(name, sizeof(name), "decode_640_density_%g", density);
+        results.push_back(measure(name, iterations, [&]() {
+            int num_proposals = 0;
+            for (int i = 0; i < 3; ++i) {
+                num_proposals += generate_proposals(anchors[i], num_grids[i], num_grids[i], strides[i], heads[i].data(),
+                                                    0.25f, num_classes, boxes.data() + num_proposals * 4,
+                                                    scores.data() + num_proposals, labels.data() + num_proposals);
+            }
+        }));
+
+        std::vector<float> fused;
+        synthetic_fused(max_num_proposals, num_classes, density, rng, fused);
+        snprintf(name, sizeof(name), "decode_fused_640_density_%g", density);
+        results.push_back(measure(name, iterations, [&]() {
+            decode_fused_output(fused.data(), max_num_proposals, num_classes, 0.25f, boxes.data(), scores.data(),
+                                labels.data());
+        }));
+    }
+}
+
+// clustered proposals like the ones of a crowded frame
+static void synthetic_proposals(const int num_boxes, std::mt19937& rng, std::vector<float>& boxes, std::vector<float>& scores) {
+    std::uniform_real_distribution<float> center(0.f, 640.f);
+    std::uniform_real_distribution<float> size(8.f, 160.f);
+    std::normal_distribution<float> jitter(0.f, 6.f);
+    std::uniform_real_distribution<float> score(0.25f, 1.f);
+
+    const int num_clusters = num_boxes / 20 + 1;
+    std::vector<float> clusters(num_clusters * 4);
+    for (float& v : clusters)
+        v = center(rng);
+    for (int c = 0; c < num_clusters; ++c) {
+        clusters[c * 4 + 2] = size(rng);
+        clusters[c * 4 + 3] = size(rng);
+    }
+
+    boxes.resize(num_boxes * 4);
+    scores.resize(num_boxes);
+    for (int i = 0; i < num_boxes; ++i) {
+        const float* cluster = clusters.data() + (rng() % num_clusters) * 4;
+        float cx = cluster[0] + jitter(rng), cy = cluster[1] + jitter(rng);
+        float w = cluster[2] + jitter(rng), h = cluster[3] + jitter(rng);
+        boxes[i * 4 + 0] = cx - w * 0.5f;
+        boxes[i * 4 + 1] = cy - h * 0.5f;
+        boxes[i * 4 + 2] = cx + w * 0.5f;
+        boxes[i * 4 + 3] = cy + h * 0.5f;
+        scores[i] = score(rng);
+    }
+}
+
+static void bench_nms(const int iterations, std::vector<BenchResult>& results) {
+    const int num_boxes_list[] = {100, 1000, 5000};
+
+    std::mt19937 rng(45);
+    for (int num_boxes : num_boxes_list) {
+        std::vector<float> boxes, scores;
+        synthetic_proposals(num_boxes, rng, boxes, scores);
+        std::vector<int64_t> keep(num_boxes);
+        int64_t num_keep = 0;
+
+        char name[64];
+        snprintf(name, sizeof(name), "nms_%d", num_boxes);
+        results.push_back(measure(name, iterations, [&]() {
+            mmcv_nms_ndarray_fp32(boxes.data(), scores.data(), num_boxes, 0.45f, 0, keep.data(), &num_keep);
+        }));
+    }
+}
+
+static void bench_preprocess(const int iterations, std::vector<BenchResult>& results) {
+    const int sizes[][2] = {{640, 640}, {1280, 720}, {1920, 1080}};
+    const float mean[3] = {0.f, 0.f, 0.f};
+    const float std[3] = {255.f, 255.f, 255.f};
+
+    std::mt19937 rng(5);
+    std::vector<float> dst(3 * 640 * 640);
+    std::vector<uint8_t> temp_buffer(letterbox_get_buffer_bytes(640, 640));
+    for (const auto& size : sizes) {
+        const int width = size[0], height = size[1];
+        std::vector<uint8_t> image(width * height * 3);
+        for (uint8_t& v : image)
+            v = rng() & 0xff;
+
+        LetterboxInfo info;
+        char name[64];
+        snprintf(name, sizeof(name), "preprocess_%dx%d_to_640", width, height);
+        results.push_back(measure(name, iterations, [&]() {
+            letterbox_bgr_to_planar(image.data(), width, height, width * 3, 640, 640, mean, std, dst.data(), &info, temp_buffer.data());
+        }));
+    }
+}
+
+// cpu model and core count, a baseline only means something on the host that recorded it
+static std::string host_description() {
+    std::string model = "unknown cpu";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, strlen("model name"), "model name") != 0)
+            continue;
+        size_t colon = line.find(':');
+        if (colon != std::string::npos && colon + 2 <= line.size())
+            model = line.substr(colon + 2);
+        break;
+    }
+    std::replace(model.begin(), model.end(), '"', '\'');
+
+    std::ostringstream host;
+    host << model << ", " << std::thread::hardware_concurrency() << " cores, "
+         << get_cpu_isa_name(get_cpu_isa()) << " kernels";
+    return host.str();
+}
+
+// the synthetic cases, everything but the end-to-end mode
+static void bench_kernels(const int iterations, std::vector<BenchResult>& results) {
+    bench_decode(iterations, results);
+    bench_nms(iterations, results);
+    bench_preprocess(iterations, results);
+}
+
+// every case measured runs times, keeping the run with its median p50, so that one lucky run sets no baseline
+static void bench_kernels_median(const int iterations, const int runs, std::vector<BenchResult>& results) {
+    std::vector<std::vector<BenchResult>> all(runs);
+    for (int run = 0; run < runs; ++run)
+        bench_kernels(iterations, all[run]);
+
+    for (size_t i = 0; i < all[0].size(); ++i) {
+        std::vector<BenchResult> of_case;
+        for (int run = 0; run < runs; ++run)
+            of_case.push_back(all[run][i]);
+        std::sort(of_case.begin(), of_case.end(),
+                  [](const BenchResult& a, const BenchResult& b) { return a.p50_us < b.p50_us; });
+        results.push_back(of_case[runs / 2]);
+    }
+}
+
+static void write_json(const std::string& host, const std::vector<BenchResult>& results, FILE* fp) {
+    fprintf(fp, "{\n  \"host\": \"%s\",\n  \"flags\": \"%s\",\n  \"benchmarks\": [\n", host.c_str(),
+            YOLOV5_BENCHMARK_FLAGS);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"iterations\": %d, \"mean_us\": %.2f, \"p50_us\": %.2f, "
+                    "\"p95_us\": %.2f, \"p99_us\": %.2f, \"throughput\": %.2f}%s\n",
+                r.name.c_str(), r.iterations, r.mean_us, r.p50_us, r.p95_us, r.p99_us, r.throughput,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+// value of "key": "..." on line, empty when the line has no such key
+static std::string read_string_field(const std::string& line, const char* key) {
+    std::string pattern = std::string("\"") + key + "\": \"";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos)
+        return std::string();
+    pos += pattern.size();
+    return line.substr(pos, line.find('"', pos) - pos);
+}
+
+// reads back the host, the flags and the p50 of every case from a file written by write_json
+static bool read_baseline(const char* path, std::string& host, std::string& flags,
+                          std::vector<std::pair<std::string, double>>& baseline) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (host.empty())
+            host = read_string_field(line, "host");
+        if (flags.empty())
+            flags = read_string_field(line, "flags");
+
+        std::string name = read_string_field(line, "name");
+        size_t p50_pos = line.find("\"p50_us\": ");
+        if (name.empty() || p50_pos == std::string::npos)
+            continue;
+
+        double p50 = atof(line.c_str() + p50_pos + strlen("\"p50_us\": "));
+        baseline.push_back(std::make_pair(name, p50));
+    }
+    return true;
+}
+
+// cases slower than their baseline p50 by more than tolerance, cases the baseline lacks are counted in missing
+static int count_regressions(const std::vector<BenchResult>& results,
+                             const std::vector<std::pair<std::string, double>>& baseline, const float tolerance,
+                             const bool report, int* missing) {
+    int regressions = 0;
+    *missing = 0;
+    for (const BenchResult& r : results) {
+        bool found = false;
+        for (const auto& b : baseline) {
+            if (b.first != r.name)
+                continue;
+
+            found = true;
+            if (r.p50_us > b.second * (1.f + tolerance)) {
+                if (report)
+                    fprintf(stderr, "REGRESSION %s: p50 %.2f us, baseline %.2f us (+%.0f%%)\n", r.name.c_str(),
+                            r.p50_us, b.second, (r.p50_us / b.second - 1.0) * 100.0);
+                ++regressions;
+            }
+        }
+        if (!found) {
+            if (report)
+                fprintf(stderr, "MISSING %s: not in the baseline\n", r.name.c_str());
+            ++*missing;
+        }
+    }
+    return regressions;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--iters N] [--runs N] [--json out.json] [--baseline baseline.json] [--tolerance 0.25]\n"
+            "          [--isa scalar|sse2|avx2|avx512] [--model yolov5.onnx --image image.jpg [--e2e-iters N]]\n",
+            argv0);
+}
+
+int main(int argc, char* argv[]){
+    int iterations = 200;
+    int runs = 1;
+    int e2e_iterations = 100;
+    float tolerance = 0.25f;
+    const char* json_path = NULL;
+    const char* baseline_path = NULL;
+    const char* model_path = NULL;
+    const char* image_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 < argc && strcmp(argv[i], "--iters") == 0) {
+            iterations = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--runs") == 0) {
+            runs = std::max(atoi(argv[++i]), 1);
+        } else if (i + 1 < argc && strcmp(argv[i], "--e2e-iters") == 0) {
+            e2e_iterations = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--json") == 0) {
+            json_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--isa") == 0) {
+            CpuIsa isa;
+            if (!parse_cpu_isa(argv[++i], &isa)) {
+                usage(argv[0]);
+                return 1;
+            }
+            set_cpu_isa(isa);
+        } else if (i + 1 < argc && strcmp(argv[i], "--model") == 0) {
+            model_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--image") == 0) {
+            image_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // on stderr, so that the json on stdout stays parseable
+    fprintf(stderr, "kernels: %s (host %s)\n", get_cpu_isa_name(get_cpu_isa()), get_cpu_isa_name(get_host_cpu_isa()));
+
+    std::vector<BenchResult> results;
+    bench_kernels_median(iterations, runs, results);
+
+    if (model_path) {
+        if (!image_path) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (run_e2e_benchmark(model_path, image_path, e2e_iterations, results) != 0)
+            return 1;
+    }
+
+    const std::string host = host_description();
+    write_json(host, results, stdout);
+    if (json_path) {
+        FILE* fp = fopen(json_path, "w");
+        if (!fp) {
+            fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+        write_json(host, results, fp);
+        fclose(fp);
+    }
+
+    if (!baseline_path)
+        return 0;
+
+    std::string baseline_host, baseline_flags;
+    std::vector<std::pair<std::string, double>> baseline;
+    if (!read_baseline(baseline_path, baseline_host, baseline_flags, baseline)) {
+        fprintf(stderr, "cannot read baseline %s\n", baseline_path);
+        return 1;
+    }
+
+    // timings of another cpu, core count or kernel variant say nothing about a regression
+    if (baseline_host != host) {
+        fprintf(stderr, "baseline %s was recorded on \"%s\", this is \"%s\"; regenerate it with "
+                        "make benchmark_baseline\n", baseline_path, baseline_host.c_str(), host.c_str());
+        return 3;
+    }
+    if (baseline_flags != YOLOV5_BENCHMARK_FLAGS) {
+        fprintf(stderr, "baseline %s was built with \"%s\", this with \"%s\"; regenerate it with "
+                        "make benchmark_baseline\n", baseline_path, baseline_flags.c_str(), YOLOV5_BENCHMARK_FLAGS);
+        return 3;
+    }
+
+    // a case missing from the baseline would never be checked, so it fails until the baseline is regenerated
+    int missing = 0;
+    int regressions = count_regressions(results, baseline, tolerance, false, &missing);
+    if (missing) {
+        count_regressions(results, baseline, tolerance, true, &missing);
+        fprintf(stderr, "%d benchmark(s) have no baseline, regenerate it with make benchmark_baseline\n", missing);
+        return 2;
+    }
+
+    // one slow run on a busy host is no regression, it has to show in every run, the fastest p50 of a case counts
+    const int max_reruns = 2;
+    for (int rerun = 0; regressions && rerun < max_reruns; ++rerun) {
+        fprintf(stderr, "re-running the synthetic cases to confirm %d regression(s)\n", regressions);
+        std::vector<BenchResult> again;
+        bench_kernels(iterations, again);
+        for (BenchResult& r : results) {
+            for (const BenchResult& a : again) {
+                if (a.name == r.name)
+                    r.p50_us = std::min(r.p50_us, a.p50_us);
+            }
+        }
+        regressions = count_regressions(results, baseline, tolerance, rerun + 1 == max_reruns, &missing);
+    }
+
+    if (regressions) {
+        fprintf(stderr, "%d benchmark(s) regressed by more than %.0f%%\n", regressions, tolerance * 100.f);
+        return 2;
+    }
+
+    return 0;
+}
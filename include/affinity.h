@@ -0,0 +1,50 @@
+#ifndef __YOLOV5_PPL_NN_AFFINITY_H__
+#define __YOLOV5_PPL_NN_AFFINITY_H__
+/**********************************************************
+* \file affinity.h
+* \brief Core sets for pinning the threads that run a runtime
+***********************************************************/
+
+#include <vector>
+
+/**
+* \brief Parse a Linux cpulist such as "0-7,16-23" or "0,2,4"
+* \return false on a malformed list
+*/
+bool parse_cpu_list(const char* cpu_list, std::vector<int>* cpus);
+
+/**
+* \brief The cores of a NUMA node as listed in /sys/devices/system/node/node<N>/cpulist
+* \return false when the node does not exist
+*/
+bool read_numa_node_cpus(const int numa_node, std::vector<int>* cpus);
+
+/**
+* \brief Split cpus into num_parts contiguous chunks of cores_per_part cores
+*
+* Falls back to num_parts copies of the whole set when there are not enough cores,
+* then the parts share the set instead of oversubscribing single cores.
+*/
+void split_cpus(const std::vector<int>& cpus, const int num_parts, const int cores_per_part,
+                std::vector<std::vector<int>>* parts);
+
+/**
+* \brief Set the intra-op thread count of the calling thread and pin it with its OpenMP team to cpus
+*
+* num_threads <= 0 keeps the current thread count, an empty cpus keeps the current affinity.
+* \return false when the affinity could not be applied
+*/
+bool bind_current_thread(const std::vector<int>& cpus, const int num_threads);
+
+/**
+* \brief bind_current_thread unless the calling thread already carries exactly this binding
+*
+* Every thread remembers the cores and thread count it was last bound to, so a thread that keeps running
+* the same runtime, or runtimes on the same cores, pays the syscalls and the re-pin of its OpenMP team
+* once. The thread stays bound afterwards.
+*
+* \return false when the affinity could not be applied
+*/
+bool ensure_current_thread_bound(const std::vector<int>& cpus, const int num_threads);
+
+#endif
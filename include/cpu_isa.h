@@ -0,0 +1,51 @@
+#ifndef __YOLOV5_PPL_NN_CPU_ISA_H__
+#define __YOLOV5_PPL_NN_CPU_ISA_H__
+/**********************************************************
+* \file cpu_isa.h
+* \brief Instruction sets of the host, picks which variant of the decode, nms and preprocess kernels runs
+***********************************************************/
+
+// the kernels get AVX2 and AVX-512 variants next to the baseline build, compiled per function
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define YOLOV5_X86_DISPATCH
+#define YOLOV5_TARGET_AVX2 __attribute__((target("avx2")))
+#define YOLOV5_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+/**
+* \brief Kernel variants from slowest to fastest, every one of them writes exactly the same results
+*/
+enum CpuIsa{
+    CPU_ISA_SCALAR = 0,      ///< plain C++
+    CPU_ISA_SSE2   = 1,      ///< 4 floats per step, the x86-64 baseline
+    CPU_ISA_AVX2   = 2,      ///< 8 floats per step
+    CPU_ISA_AVX512 = 3,      ///< 16 floats per step, AVX-512F
+};
+
+/**
+* \brief Best variant the host can run, from cpuid and the register state the OS saves, detected once
+*/
+CpuIsa get_host_cpu_isa();
+
+/**
+* \brief Variant the kernels use, the host's best unless YOLOV5_CPU_ISA or set_cpu_isa asked for less
+*/
+CpuIsa get_cpu_isa();
+
+/**
+* \brief Use isa from now on, clamped to what the host supports
+*
+* Meant for start up and tests, calls already running keep the variant they started with.
+*
+* \return the variant now in use
+*/
+CpuIsa set_cpu_isa(const CpuIsa isa);
+
+const char* get_cpu_isa_name(const CpuIsa isa);
+
+/**
+* \brief Parse "scalar", "sse2", "avx2" or "avx512"
+*/
+bool parse_cpu_isa(const char* name, CpuIsa* isa);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __YOLOV5_PPL_NN_DETECTION_IO_H__
+#define __YOLOV5_PPL_NN_DETECTION_IO_H__
+/**********************************************************
+* \file detection_io.h
+* \brief Binary detection files, appended frame by frame and read back through mmap
+*
+* A file is the 8 byte header "YDET" + uint32 version followed by one record per frame:
+*
+*   uint32 record_bytes   bytes of the record after this field
+*   uint32 count          number of detections
+*   uint64 frame_id
+*   float  x1[count], y1[count], x2[count], y2[count], score[count]
+*   int32  label[count]
+*
+* in host byte order. Every field is 4 byte aligned in the file, so the reader hands out
+* pointers into the mapping instead of copying, and a record cut short by a crashed
+* writer is ignored along with everything after it.
+***********************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "detections.h"
+#include "ppl/common/retcode.h"
+
+/**
+* \brief One record of a detection file, the arrays point into the mapping of the reader
+*/
+struct DetectionFrameView{
+    uint64_t frame_id;
+    uint32_t count;
+    const float* x1;
+    const float* y1;
+    const float* x2;
+    const float* y2;
+    const float* score;
+    const int32_t* label;
+};
+
+class DetectionWriter{
+    public:
+        DetectionWriter() : fp(NULL) {}
+        ~DetectionWriter() { close(); }
+
+        DetectionWriter(const DetectionWriter&) = delete;
+        DetectionWriter& operator=(const DetectionWriter&) = delete;
+
+        /**
+        * \brief Create path, or with append keep the frames already in it
+        *
+        * Appending cuts off a record left incomplete by a crashed writer first, so the new frames
+        * follow the last complete one and stay readable.
+        */
+        ppl::common::RetCode open(const char* path, const bool append);
+
+        ppl::common::RetCode write_frame(const uint64_t frame_id, const Detections& detections);
+
+        ppl::common::RetCode flush();
+        void close();
+
+    private:
+        FILE* fp;
+        std::vector<char> file_buffer;   ///< stdio buffer, large enough to batch many small frames per write
+};
+
+class DetectionReader{
+    public:
+        DetectionReader() : data(NULL), size(0), position(0) {}
+        ~DetectionReader() { close(); }
+
+        DetectionReader(const DetectionReader&) = delete;
+        DetectionReader& operator=(const DetectionReader&) = delete;
+
+        ppl::common::RetCode open(const char* path);
+
+        /**
+        * \brief The next complete record, false at the end of the file or of its complete records
+        */
+        bool next(DetectionFrameView* view);
+
+        void rewind();
+        void close();
+
+    private:
+        const char* data;
+        size_t size;
+        size_t position;
+};
+
+#endif
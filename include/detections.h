@@ -0,0 +1,69 @@
+#ifndef __YOLOV5_PPL_NN_DETECTIONS_H__
+#define __YOLOV5_PPL_NN_DETECTIONS_H__
+/**********************************************************
+* \file detections.h
+* \brief Detections of one image as float SoA arrays
+***********************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "utils.h"
+
+/**
+* \brief Detections of one image, box i is (x1[i], y1[i], x2[i], y2[i]) with score[i] and label[i]
+*
+* Coordinates keep their sub-pixel part. clear() keeps the capacity, so a container reused
+* across frames stops allocating once it held the largest frame.
+*/
+struct Detections{
+    std::vector<float> x1;       ///< left
+    std::vector<float> y1;       ///< top
+    std::vector<float> x2;       ///< right
+    std::vector<float> y2;       ///< bottom
+    std::vector<float> score;    ///< confidence
+    std::vector<int32_t> label;  ///< class id
+
+    size_t size() const { return score.size(); }
+    bool empty() const { return score.empty(); }
+
+    void clear() {
+        x1.clear(); y1.clear(); x2.clear(); y2.clear();
+        score.clear();
+        label.clear();
+    }
+
+    void reserve(const size_t n) {
+        x1.reserve(n); y1.reserve(n); x2.reserve(n); y2.reserve(n);
+        score.reserve(n);
+        label.reserve(n);
+    }
+
+    void push_back(const float* box, const float box_score, const int32_t box_label) {
+        x1.push_back(box[0]);
+        y1.push_back(box[1]);
+        x2.push_back(box[2]);
+        y2.push_back(box[3]);
+        score.push_back(box_score);
+        label.push_back(box_label);
+    }
+
+    /**
+    * \brief Append every detection to detect_res, coordinates are truncated to int
+    */
+    void append_to(std::vector<DetectRes>& detect_res) const {
+        for (size_t i = 0; i < size(); ++i) {
+            DetectRes res;
+            res.x_min = x1[i];
+            res.y_min = y1[i];
+            res.x_max = x2[i];
+            res.y_max = y2[i];
+            res.label = label[i];
+            res.prob  = score[i];
+            detect_res.push_back(res);
+        }
+    }
+};
+
+#endif
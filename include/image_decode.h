@@ -0,0 +1,35 @@
+#ifndef __YOLOV5_PPL_NN_IMAGE_DECODE_H__
+#define __YOLOV5_PPL_NN_IMAGE_DECODE_H__
+/**********************************************************
+* \file image_decode.h
+* \brief Decode encoded images from memory at the smallest size the model input needs
+***********************************************************/
+
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+#include "ppl/common/retcode.h"
+
+/**
+* \brief Width and height of a JPEG from its SOF marker, without decoding anything
+* \return false when data is not a JPEG or has no frame header before the first scan
+*/
+bool read_jpeg_size(const uint8_t* data, const uint64_t size, int* width, int* height);
+
+/**
+* \brief Largest of the DCT scalings 1/2, 1/4 and 1/8 at which a width x height JPEG still
+* covers its letterbox into target_width x target_height, so preprocess never upsamples
+* \return the denominator, 1 when the image has to be decoded at full size
+*/
+int choose_jpeg_scale_denom(const int width, const int height, const int target_width, const int target_height);
+
+/**
+* \brief BGR decode of an encoded image, JPEGs straight at the reduced scale chosen above
+*
+* scale_x and scale_y map coordinates of the decoded image back to the full size image, EXIF
+* orientation included. Other formats are decoded at full size with scales of 1.
+*/
+ppl::common::RetCode decode_image(const uint8_t* data, const uint64_t size, const int target_width,
+                                  const int target_height, cv::Mat* image, float* scale_x, float* scale_y);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __YOLOV5_PPL_NN_LOG_H__
+#define __YOLOV5_PPL_NN_LOG_H__
+/**********************************************************
+* \file log.h
+* \brief Progress logging which compiles out unless YOLOV5_ENABLE_LOG is defined
+***********************************************************/
+
+#include <stdio.h>
+
+#ifdef YOLOV5_ENABLE_LOG
+#define YOLOV5_LOG(...) fprintf(stderr, __VA_ARGS__)
+#else
+// never runs, but keeps the format checked and the arguments used
+#define YOLOV5_LOG(...) do { if (0) fprintf(stderr, __VA_ARGS__); } while (0)
+#endif
+
+#endif
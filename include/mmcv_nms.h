@@ -19,7 +19,13 @@
 #define __ST_PPL_KERNEL_X86_FP32_MMCV_NMS_H_
 #include "ppl/common/retcode.h"
 
-
+/**
+* \brief Greedy NMS over [num_boxes_in, 4] boxes (x1, y1, x2, y2)
+*
+* dst receives the indices of the kept boxes in descending score order and must hold
+* num_boxes_in entries. Dispatches to the fastest implementation below, all of them
+* return exactly the same indices.
+*/
 ppl::common::RetCode mmcv_nms_ndarray_fp32(
         const float *boxes,
         const float *scores,
@@ -29,4 +35,46 @@ ppl::common::RetCode mmcv_nms_ndarray_fp32(
         int64_t *dst,
         int64_t *num_boxes_out);
 
+/**
+* \brief Bytes of temp_buffer needed by mmcv_nms_ndarray_fp32_with_buffer
+*/
+uint64_t mmcv_nms_ndarray_fp32_get_buffer_bytes(const uint32_t num_boxes_in);
+
+/**
+* \brief Same as mmcv_nms_ndarray_fp32 without any heap allocation, scratch space comes from temp_buffer
+*/
+ppl::common::RetCode mmcv_nms_ndarray_fp32_with_buffer(
+        const float *boxes,
+        const float *scores,
+        const uint32_t num_boxes_in,
+        const float iou_threshold,
+        const int64_t offset,
+        void *temp_buffer,
+        int64_t *dst,
+        int64_t *num_boxes_out);
+
+/**
+* \brief Reference implementation, compares every candidate with every kept box one pair at a time
+*/
+ppl::common::RetCode mmcv_nms_ndarray_fp32_naive(
+        const float *boxes,
+        const float *scores,
+        const uint32_t num_boxes_in,
+        const float iou_threshold,
+        const int64_t offset,
+        int64_t *dst,
+        int64_t *num_boxes_out);
+
+/**
+* \brief Sorted SoA boxes, every kept box suppresses a block of 4, 8 or 16 candidates per SIMD step (see cpu_isa.h)
+*/
+ppl::common::RetCode mmcv_nms_ndarray_fp32_soa(
+        const float *boxes,
+        const float *scores,
+        const uint32_t num_boxes_in,
+        const float iou_threshold,
+        const int64_t offset,
+        int64_t *dst,
+        int64_t *num_boxes_out);
+
 #endif //! __ST_PPL_KERNEL_X86_FP32_MMCV_NMS_H_
@@ -0,0 +1,56 @@
+#ifndef __YOLOV5_PPL_NN_PREPROCESS_H__
+#define __YOLOV5_PPL_NN_PREPROCESS_H__
+/**********************************************************
+* \file preprocess.h
+* \brief Fused letterbox + BGR2RGB + HWC2CHW + normalize
+***********************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "utils.h"
+
+/**
+* \brief How a source image was placed into the model input
+*/
+struct LetterboxInfo{
+    float scale;             ///< model input pixels per source pixel
+    int pad_left;            ///< padded columns left of the resized image
+    int pad_top;             ///< padded rows above the resized image
+    int src_width;           ///< width of the source image
+    int src_height;          ///< height of the source image
+};
+
+/**
+* \brief Letterbox a packed BGR uint8 image into a planar RGB float tensor in one pass
+*
+* The image is resized with bilinear interpolation keeping its aspect ratio, centered
+* and padded with gray 114, and every written value is (x - mean[c]) / std[c] with
+* mean and std given in RGB order. dst holds 3 * dst_height * dst_width floats.
+* temp_buffer holds letterbox_get_buffer_bytes(dst_width, dst_height) bytes, or is NULL
+* to allocate the scratch space on every call.
+*/
+void letterbox_bgr_to_planar(const uint8_t* src,
+                             const int src_width,
+                             const int src_height,
+                             const size_t src_step,
+                             const int dst_width,
+                             const int dst_height,
+                             const float mean[3],
+                             const float std[3],
+                             float* dst,
+                             LetterboxInfo* info,
+                             void* temp_buffer);
+
+/**
+* \brief Bytes of the resampling tables and row cache of letterbox_bgr_to_planar
+*/
+uint64_t letterbox_get_buffer_bytes(const int dst_width, const int dst_height);
+
+/**
+* \brief Map boxes from model input coordinates back onto the source image
+*/
+void scale_coords(const LetterboxInfo& info, float* boxes, const int num_boxes);
+
+#endif
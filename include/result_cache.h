@@ -0,0 +1,91 @@
+#ifndef __YOLOV5_PPL_NN_RESULT_CACHE_H__
+#define __YOLOV5_PPL_NN_RESULT_CACHE_H__
+/**********************************************************
+* \file result_cache.h
+* \brief Bounded LRU cache of detections keyed by a hash of the input content
+***********************************************************/
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "detections.h"
+
+/**
+* \brief Snapshot of the counters of a result cache
+*/
+struct ResultCacheCounters{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;          ///< entries dropped to stay below the memory cap
+    uint64_t entries;            ///< entries held right now
+    uint64_t bytes;              ///< estimated memory of the held entries
+};
+
+/**
+* \brief Concurrent LRU map from a 64 bit content hash to the detections of that content
+*
+* Keys are spread over shards with a mutex and an LRU list each, so concurrent callers rarely
+* contend. Every shard holds at most capacity_bytes / num_shards; a result larger than that is
+* not cached. Two different inputs only share a key on a 64 bit hash collision.
+*/
+class ResultCache{
+    public:
+        explicit ResultCache(const uint64_t capacity_bytes, const int num_shards = 16);
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        /**
+        * \brief Copy the detections cached under key into detections and mark them most recently used
+        */
+        bool lookup(const uint64_t key, Detections* detections);
+
+        /**
+        * \brief Cache detections under key, evicting the least recently used entries of its shard as needed
+        */
+        void insert(const uint64_t key, const Detections& detections);
+
+        void clear();
+
+        ResultCacheCounters get_counters() const;
+
+        /**
+        * \brief Fast non cryptographic 64 bit hash in the style of xxHash64, chain calls through seed
+        */
+        static uint64_t hash_bytes(const void* data, const uint64_t size, const uint64_t seed);
+
+    private:
+        struct Entry{
+            uint64_t key;
+            uint64_t bytes;
+            Detections detections;
+        };
+
+        struct Shard{
+            std::mutex mutex;
+            std::list<Entry> lru;    ///< most recently used first
+            std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+            uint64_t bytes;
+
+            Shard() : bytes(0) {}
+        };
+
+        uint64_t shard_capacity;
+        std::unique_ptr<Shard[]> shards;
+        int num_shards;
+
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> insertions;
+        std::atomic<uint64_t> evictions;
+
+        Shard& shard_of(const uint64_t key) { return shards[(key >> 32) % num_shards]; }
+        static uint64_t entry_bytes(const Detections& detections);
+};
+
+#endif
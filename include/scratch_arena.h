@@ -0,0 +1,100 @@
+#ifndef __YOLOV5_PPL_NN_SCRATCH_ARENA_H__
+#define __YOLOV5_PPL_NN_SCRATCH_ARENA_H__
+/**********************************************************
+* \file scratch_arena.h
+* \brief Grow-only bump allocator for per frame scratch buffers
+***********************************************************/
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+* \brief Hands out scratch memory from one block which only grows between frames
+*
+* Buffers live until the next reset(). A request which does not fit gets a block of its own,
+* and the next reset() replaces the main block by one holding the whole frame, so after the
+* first frames of a given size alloc() never touches the heap. Not thread safe, every
+* concurrent caller needs its own arena.
+*/
+class ScratchArena{
+    public:
+        static const size_t kAlignment = 64;
+
+        ScratchArena() : block(NULL), capacity(0), used(0) {}
+        ~ScratchArena() { release(); }
+
+        ScratchArena(const ScratchArena&) = delete;
+        ScratchArena& operator=(const ScratchArena&) = delete;
+
+        /**
+        * \brief Make sure a frame of the given size is served from the main block, drops all buffers
+        */
+        void reserve(const size_t bytes) {
+            reset();
+            if (bytes <= capacity)
+                return;
+
+            ::operator delete(block);
+            block = static_cast<char*>(::operator new(bytes + kAlignment));
+            capacity = bytes;
+        }
+
+        /**
+        * \brief Uninitialized room for count elements of T, aligned to kAlignment
+        */
+        template <typename T>
+        T* alloc(const size_t count) {
+            const size_t bytes = (count * sizeof(T) + kAlignment - 1) & ~(kAlignment - 1);
+            char* base = align(block);
+            if (block && used + bytes <= capacity) {
+                T* p = reinterpret_cast<T*>(base + used);
+                used += bytes;
+                return p;
+            }
+
+            // kept until reset, which then grows the main block to the whole frame
+            used += bytes;
+            overflow.push_back(::operator new(bytes + kAlignment));
+            return reinterpret_cast<T*>(align(static_cast<char*>(overflow.back())));
+        }
+
+        /**
+        * \brief Invalidate every buffer handed out since the last reset
+        */
+        void reset() {
+            const size_t frame_bytes = used;
+            used = 0;
+            if (overflow.empty())
+                return;
+
+            for (void* p : overflow)
+                ::operator delete(p);
+            overflow.clear();
+            reserve(frame_bytes);
+        }
+
+        size_t get_capacity() const { return capacity; }
+
+    private:
+        char* block;
+        size_t capacity;       ///< usable bytes of block after alignment
+        size_t used;           ///< bytes handed out in this frame, overflow included
+        std::vector<void*> overflow;
+
+        static char* align(char* p) {
+            return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + kAlignment - 1) & ~(kAlignment - 1));
+        }
+
+        void release() {
+            for (void* p : overflow)
+                ::operator delete(p);
+            overflow.clear();
+            ::operator delete(block);
+            block = NULL;
+            capacity = 0;
+        }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __YOLOV5_PPL_NN_SPSC_QUEUE_H__
+#define __YOLOV5_PPL_NN_SPSC_QUEUE_H__
+/**********************************************************
+* \file spsc_queue.h
+* \brief Bounded lock-free single producer single consumer queue
+***********************************************************/
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+template <typename T>
+class SpscQueue{
+    public:
+        explicit SpscQueue(const size_t capacity) : buffer(capacity + 1), head(0), tail(0) {}
+
+        /**
+        * \brief Only called by the producer thread, returns false when the queue is full
+        */
+        bool push(const T& value) {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            const size_t next = (t + 1) % buffer.size();
+            if (next == head.load(std::memory_order_acquire))
+                return false;
+
+            buffer[t] = value;
+            tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        /**
+        * \brief Only called by the consumer thread, returns false when the queue is empty
+        */
+        bool pop(T& value) {
+            const size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire))
+                return false;
+
+            value = buffer[h];
+            head.store((h + 1) % buffer.size(), std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::vector<T> buffer;      ///< one slot stays free to tell full from empty
+        char pad0[64];              ///< keep head and tail on separate cache lines
+        std::atomic<size_t> head;   ///< next slot to pop, written by the consumer
+        char pad1[64];
+        std::atomic<size_t> tail;   ///< next slot to push, written by the producer
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __YOLOV5_PPL_NN_STATS_H__
+#define __YOLOV5_PPL_NN_STATS_H__
+/**********************************************************
+* \file stats.h
+* \brief Lock-free latency histograms and counters of the detect path
+***********************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+* \brief Log-linear histogram of durations, 4 buckets per power of two nanoseconds
+*
+* record() is wait-free and may be called from any number of threads, readers see
+* a slightly stale but consistent enough view.
+*/
+class LatencyHistogram{
+    public:
+        static const int kNumBuckets = 64 * 4;
+
+        LatencyHistogram() { reset(); }
+
+        void record(const uint64_t ns);
+        void reset();
+
+        uint64_t count() const { return total_count.load(std::memory_order_relaxed); }
+        double mean_us() const;
+        double max_us() const { return max_ns.load(std::memory_order_relaxed) / 1000.0; }
+
+        /**
+        * \brief Upper bound of the bucket holding the given percentile in [0, 100], at most 25% above the true value
+        */
+        double percentile_us(const double percentile) const;
+
+    private:
+        std::atomic<uint64_t> buckets[kNumBuckets];
+        std::atomic<uint64_t> total_count;
+        std::atomic<uint64_t> total_ns;
+        std::atomic<uint64_t> max_ns;
+};
+
+/**
+* \brief The timed stages of one detect call
+*/
+enum DetectStage{
+    STAGE_IMAGE_DECODE = 0,         ///< only the calls which get encoded bytes
+    STAGE_PREPROCESS,
+    STAGE_CONVERT_FROM_HOST,
+    STAGE_RUN,
+    STAGE_CONVERT_TO_HOST,
+    STAGE_DECODE_HEAD0,             ///< also the whole decode of a fused output
+    STAGE_DECODE_HEAD1,
+    STAGE_DECODE_HEAD2,
+    STAGE_NMS,
+    STAGE_COUNT
+};
+
+const char* get_stage_name(const DetectStage stage);
+
+/**
+* \brief Everything Yolov5Impl measures, shared by all runtimes of the pool
+*/
+struct DetectStats{
+    LatencyHistogram stages[STAGE_COUNT];
+
+    std::atomic<uint64_t> images;          ///< decoded images
+    std::atomic<uint64_t> proposals;       ///< proposals out of the decoder, summed over images
+    std::atomic<uint64_t> nms_inputs;      ///< proposals left after pre-nms top-k
+    std::atomic<uint64_t> detections;      ///< boxes returned to callers
+
+    DetectStats() { reset(); }
+
+    void reset();
+
+    /**
+    * \brief Human readable table of every stage and counter
+    */
+    void print(FILE* fp) const;
+};
+
+/**
+* \brief Records the time from construction to destruction into a histogram
+*/
+class ScopedTimer{
+    public:
+        explicit ScopedTimer(LatencyHistogram& histogram)
+            : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+    private:
+        LatencyHistogram& histogram;
+        std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -1,7 +1,13 @@
 #ifndef __YOLOV5_PPL_NN_UTILS_H__
 #define __YOLOV5_PPL_NN_UTILS_H__
+#include <stdint.h>
 #include <vector>
 
+#include "scratch_arena.h"
+
+struct Detections;
+struct LetterboxInfo;
+
 struct DetectRes{
     int x_min;               ///< left top x_min
     int y_min;               ///< left top y_min
@@ -11,13 +17,139 @@ struct DetectRes{
     float prob;              ///< scores
 };
 
-void generate_proposals(std::vector<float> anchor,
-                        const int num_grid_w,
-                        const int num_grid_h,
-                        const int stride,
-                        const float* output,
-                        float prob_threshold,
-                        int num_classes,
-                        std::vector<DetectRes>& detect_res);
+/**
+* \brief Decode one raw yolov5 head of shape [num_anchor, num_grid_h, num_grid_w, 5 + num_classes].
+*
+* Cells are rejected on their objectness logit before any exp() is evaluated, and the
+* class argmax only runs on the cells that survive. Proposals are written as float boxes
+* (x_min, y_min, x_max, y_max) into preallocated buffers which must hold at least
+* num_anchor * num_grid_h * num_grid_w entries.
+*
+* \return the number of proposals written
+*/
+int generate_proposals(const std::vector<float>& anchor,
+                       const int num_grid_w,
+                       const int num_grid_h,
+                       const int stride,
+                       const float* output,
+                       float prob_threshold,
+                       int num_classes,
+                       float* boxes,
+                       float* scores,
+                       int* labels);
+
+/**
+* \brief Decode the rows [row_begin, row_end) of one anchor plane [num_grid_h, num_grid_w, 5 + num_classes]
+*
+* output points at row 0 of the plane. Slices of disjoint rows touch disjoint memory, so they can be
+* decoded on different threads into buffers of their own.
+*
+* \return the number of proposals written
+*/
+int generate_proposals_rows(const float anchor_w,
+                            const float anchor_h,
+                            const int num_grid_w,
+                            const int row_begin,
+                            const int row_end,
+                            const int stride,
+                            const float* output,
+                            float prob_threshold,
+                            const int num_classes,
+                            float* boxes,
+                            float* scores,
+                            int* labels);
+
+/**
+* \brief Decode an in-graph decoded output [num_boxes, 5 + num_classes] of (cx, cy, w, h, obj, cls...)
+*
+* Objectness and class scores are already probabilities. Rows are checked four at a time on
+* obj >= prob_threshold, which bounds obj * cls from above, and the class argmax only runs on
+* the rows that pass. Buffers are the same as for generate_proposals and hold num_boxes entries.
+*
+* \return the number of proposals written
+*/
+int decode_fused_output(const float* output,
+                        const int num_boxes,
+                        const int num_classes,
+                        const float prob_threshold,
+                        float* boxes,
+                        float* scores,
+                        int* labels);
+
+/**
+* \brief Keep the k highest scored proposals in place, by partial selection instead of a full sort
+*
+* Survivors keep their relative order, so ties are broken in NMS just as without the selection.
+* temp_buffer holds num_proposals ints.
+*
+* \return the number of proposals left, min(num_proposals, k)
+*/
+int select_topk_proposals(float* boxes,
+                          float* scores,
+                          int* labels,
+                          const int num_proposals,
+                          const int k,
+                          int* temp_buffer);
+
+/**
+* \brief Shift every box by label * (2 * max |coordinate| + 1)
+*
+* Boxes of different labels can then never overlap, so a single class agnostic NMS
+* over dst suppresses per class.
+*/
+void offset_boxes_by_label(const float* boxes,
+                           const int* labels,
+                           const int num_boxes,
+                           float* dst);
+
+/**
+* \brief Pre-NMS top k, per class or class agnostic NMS and the max_det cap over decoded proposals
+*
+* pre_nms_topk and max_det <= 0 disable their step. Scratch space comes from arena, keep holds
+* num_proposals entries and receives the kept indices in descending score order.
+*
+* \return the number of kept proposals
+*/
+int suppress_proposals(float* boxes,
+                       float* scores,
+                       int* labels,
+                       const int num_proposals,
+                       const int pre_nms_topk,
+                       const float nms_threshold,
+                       const bool class_agnostic,
+                       const int max_det,
+                       ScratchArena* arena,
+                       int64_t* keep);
+
+/**
+* \brief The host side of a postprecess once an image is decoded: suppress_proposals, then the kept boxes
+*        scaled back through letterbox into detections, which is cleared first
+*
+* Scratch space comes from arena, so a frame allocates nothing once arena and detections have grown.
+*
+* \return the number of detections
+*/
+int select_detections(float* boxes,
+                      float* scores,
+                      int* labels,
+                      const int num_proposals,
+                      const int pre_nms_topk,
+                      const float nms_threshold,
+                      const bool class_agnostic,
+                      const int max_det,
+                      const LetterboxInfo& letterbox,
+                      ScratchArena* arena,
+                      Detections* detections);
+
+/**
+* \brief Start offsets of tiles of size tile covering [0, length), neighbours share at least overlap pixels
+*
+* The last tile is aligned to the end, so every tile lies inside the image when length >= tile
+* and a single tile at 0 covers a shorter axis.
+*/
+void compute_tile_offsets(const int length,
+                          const int tile,
+                          const int overlap,
+                          std::vector<int>* offsets);
 
-#endif
\ No newline at end of file
+#endif
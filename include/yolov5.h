@@ -7,31 +7,115 @@
 * \author runrunrun1994
 ***********************************************************/
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <opencv2/opencv.hpp>
 #include "ppl/nn/models/onnx/onnx_runtime_builder_factory.h"
 #include "ppl/nn/engines/x86/engine_factory.h"
 #include "ppl/nn/engines/x86/x86_engine_options.h"
+#include "detections.h"
+#include "preprocess.h"
+#include "result_cache.h"
+#include "scratch_arena.h"
+#include "stats.h"
 #include "utils.h"
 /**
-* \brief The params of yolov5 model
+* \brief The params of yolov5 model, every field defaults to the stock yolov5s COCO export
+*
+* NMS defaults to the original class agnostic pass without caps, set class_agnostic = false,
+* pre_nms_topk = 30000 and max_det = 300 for the detections of the yolov5 repository.
 */
-
 struct ModelParams{
-    int yolov5_height;       ///< height
-    int yolov5_width;        ///< width
-    int yolov5_channel;      ///< channel
+    int yolov5_height = 640;     ///< height, the largest one when dynamic_shape is set
+    int yolov5_width = 640;      ///< width, the largest one when dynamic_shape is set
+    int yolov5_channel = 3;      ///< channel
+
+    int num_classes = 80;        ///< the number of classes
+    const char* onnx_path = NULL;     ///< the path of onnx model, mapped into memory instead of read when possible
+    const char* model_buffer = NULL;  ///< onnx model already in memory, used instead of onnx_path when not NULL
+    uint64_t model_buffer_size = 0;   ///< size of model_buffer in bytes, the buffer is only read during init
+    int num_warmup = 1;          ///< dummy frames run through every runtime at init, so the first request is not the slow one
+
+    float mean[3] = {0.f, 0.f, 0.f};         ///< The mean of input image
+    float std[3] = {255.f, 255.f, 255.f};    ///< The std of input image
+
+    const float* anchors = NULL; ///< 18 floats, (w, h) of the 3 anchors of the stride 8, 16 and 32 heads, NULL for the yolov5 defaults, copied at construction
+
+    float prob_threshold = 0.25f;    ///< score threshold
+    float nms_threshold = 0.45f;     ///< iou threshold
+    bool class_agnostic = true;      ///< suppress boxes of different labels against each other, false for the yolov5 per class nms
+    int pre_nms_topk = 0;            ///< only the top k proposals go into nms, <= 0 keeps all, yolov5 uses 30000
+    int max_det = 0;                 ///< the maximum number of detections per image, <= 0 is unlimited, yolov5 uses 300
+
+    int num_runtimes = 1;            ///< the number of runtimes created for concurrent callers, and of frames running at once
+    bool dynamic_shape = false;      ///< run every frame at the smallest stride aligned rectangle that fits its aspect ratio
+    int shape_cache_runtimes = 2;    ///< runtimes created on top of num_runtimes for input shapes no idle runtime has, each keeps its shape, 0 reshapes instead
+    bool enable_profiling = false;   ///< collect ppl.nn per kernel timings, needs ppl.nn built with PPLNN_ENABLE_KERNEL_PROFILING
+
+    int num_threads = 0;             ///< intra-op threads of every runtime, <= 0 keeps the OpenMP default
+    int decode_threads = 0;          ///< threads of the runtime's OpenMP team splitting the decode by head and row range, <= 1 decodes on the caller
+    int mm_policy = ppl::nn::X86_MM_MRU;  ///< ppl::nn::X86_MM_MRU reuses freed blocks, X86_MM_COMPACT keeps the peak memory low
+    const char* cpu_list = NULL;     ///< cores to pin to, e.g. "0-15", split num_threads cores per runtime when large enough, NULL to not pin
+    int numa_node = -1;              ///< pin to the cores of this NUMA node when cpu_list is NULL, < 0 to not pin
+
+    uint64_t result_cache_bytes = 0; ///< memory cap of the results cached by input content, 0 disables the cache
+};
+
+/**
+* \brief How yolov5_network_detect_tiled cuts a large image
+*/
+struct TileParams{
+    int tile_width;          ///< tile width in source pixels, <= 0 uses yolov5_width
+    int tile_height;         ///< tile height in source pixels, <= 0 uses yolov5_height
+    int overlap;             ///< pixels shared by neighbouring tiles, about the size of the largest small object
+    int tiles_per_batch;     ///< tiles run by one Runtime::Run, the batches are spread over the runtime pool in parallel
+    bool full_frame_pass;    ///< also detect on the whole image downscaled to the model input, for objects larger than a tile
+    float merge_iou_threshold;   ///< iou of duplicates across tile seams, <= 0 uses nms_threshold
+};
+
+/**
+* \brief How the exported model hands out its detections
+*/
+enum OutputLayout{
+    OUTPUT_LAYOUT_UNKNOWN = 0,   ///< not resolved yet, done on the first postprecess of a runtime
+    OUTPUT_LAYOUT_RAW_HEADS,     ///< three heads [N, 3, grid_h, grid_w, 5 + C] of logits, decoded with the anchors
+    OUTPUT_LAYOUT_FUSED,         ///< one [N, num_boxes, 5 + C] output of the Detect layer, boxes in input pixels
+};
 
-    int num_classes;         ///< the number of classes
-    char* onnx_path;         ///< the path of onnx model
+/**
+* \brief One runtime of the pool together with the buffers only its caller may touch
+*/
+struct RuntimeContext{
+    std::unique_ptr<ppl::nn::Runtime> runtime;
+    ppl::nn::Tensor* input_tensor;   ///< owned by runtime
+    float* in_data;                  ///< host NCHW input, only used when input_tensor needs a conversion
+    uint64_t in_data_size;           ///< capacity of in_data in floats
+    float* input_data;               ///< where preprocess writes, the buffer of input_tensor on the zero copy path
+    bool input_zero_copy;            ///< input_tensor is NDARRAY fp32 and is written in place
+    int batch_size;                  ///< current batch dim of input_tensor
+    int input_height;                ///< current height dim of input_tensor
+    int input_width;                 ///< current width dim of input_tensor
+    std::vector<LetterboxInfo> letterbox;   ///< placement of every image of the batch
+    std::vector<int> cpus;           ///< cores the threads running this runtime are pinned to, empty when not pinned
+
+    std::vector<const float*> outputs;           ///< NDARRAY fp32 view of every output after the last Run
+    std::vector<std::vector<float>> output_host; ///< converted copies of the outputs which are not NDARRAY fp32
 
-    float mean[3];           ///< The mean of input image
-    float std[3];            ///< The std of input image
+    ppl::nn::TensorShape input_desc;               ///< NDARRAY fp32 description of in_data
+    std::vector<ppl::nn::TensorShape> output_desc; ///< NDARRAY fp32 descriptions of output_host
+    OutputLayout output_layout;                    ///< layout of the outputs, the same for every Run
+    int head_outputs[3];                           ///< output index of the stride 8, 16 and 32 heads, [0] is the fused output
+    ScratchArena scratch;                          ///< per frame buffers of preprocess and postprecess
+    uint64_t last_used;                            ///< acquire order, the least recently used idle runtime is reshaped on a miss
+    Detections detections;                         ///< results of the last postprecess into DetectRes
 
-    float prob_threshold;    ///< score threshold
-    float nms_threshold;     ///< iou threshold
+    RuntimeContext() : input_tensor(NULL), in_data(NULL), in_data_size(0), input_data(NULL), input_zero_copy(false),
+                       batch_size(0), input_height(0), input_width(0), output_layout(OUTPUT_LAYOUT_UNKNOWN),
+                       head_outputs{-1, -1, -1}, last_used(0) {}
+    ~RuntimeContext() { runtime.reset(); free(in_data); }
 };
 
 /**
@@ -45,16 +129,120 @@ class Yolov5Impl{
 
         ppl::common::RetCode yolov5_network_detect_init();
 
+        /**
+        * \brief Thread safe, every call checks one runtime out of the pool and blocks while all are busy
+        *
+        * src is the decoded BGR image at any size, detections are appended to detect_res in its
+        * coordinates. Once warmed up a call does not allocate, as long as detect_res is reused with
+        * enough capacity.
+        */
         ppl::common::RetCode yolov5_network_detect(cv::Mat& src, std::vector<DetectRes>& detect_res);
 
+        /**
+        * \brief Same as above with float coordinates, detections is overwritten and reusing it avoids allocations
+        */
+        ppl::common::RetCode yolov5_network_detect(cv::Mat& src, Detections& detections);
+
+        /**
+        * \brief Detect on an encoded image in memory, JPEGs are decoded at the smallest DCT scale the input needs
+        *
+        * Boxes are returned in the coordinates of the full size image. Costs a fraction of the decode
+        * time and memory of cv::imread for photos much larger than the model input.
+        */
+        ppl::common::RetCode yolov5_network_detect_encoded(const uint8_t* data, const uint64_t size,
+                                                           Detections& detections);
+        ppl::common::RetCode yolov5_network_detect_encoded(const uint8_t* data, const uint64_t size,
+                                                           std::vector<DetectRes>& detect_res);
+
+        /**
+        * \brief Detect N images with a single Runtime::Run, detect_res[n] holds the results of srcs[n]
+        */
+        ppl::common::RetCode yolov5_network_detect_batch(std::vector<cv::Mat>& srcs,
+                                                         std::vector<std::vector<DetectRes>>& detect_res);
+        ppl::common::RetCode yolov5_network_detect_batch(std::vector<cv::Mat>& srcs, std::vector<Detections>& detections);
+
+        /**
+        * \brief Detect small objects in a large image by cutting it into overlapping model sized tiles
+        *
+        * Tiles are grouped into batches of tiles_per_batch which run concurrently on the runtime pool,
+        * so num_runtimes bounds the parallelism. Tile results are moved to src coordinates and merged
+        * across seams with one more class aware NMS, then capped at max_det.
+        */
+        ppl::common::RetCode yolov5_network_detect_tiled(cv::Mat& src, const TileParams& tile_params,
+                                                         std::vector<DetectRes>& detect_res);
+
+        /**
+        * \brief Latency histograms of every stage and proposal counters, updated lock-free by all callers
+        */
+        const DetectStats& get_stats() const { return stats; }
+        void reset_stats() { stats.reset(); }
+
+        /**
+        * \brief Hits, misses and evictions of the result cache, all zero when result_cache_bytes is 0
+        */
+        ResultCacheCounters get_cache_counters() const;
+
+        /**
+        * \brief Per kernel timings summed over the runtime pool, waits until no runtime is running
+        * \return RC_UNSUPPORTED unless enable_profiling is set and ppl.nn was built with kernel profiling
+        */
+        ppl::common::RetCode get_kernel_profile(ppl::nn::ProfilingStatistics* profile);
+
     private:
+        friend class Yolov5Pipeline;
+        class RuntimeLease;
+
         ModelParams model_params;
-        float* in_data;
-        std::unique_ptr<ppl::nn::Runtime> context;
-        std::shared_ptr<ppl::nn::Tensor> input_tensor;
+        std::vector<float> anchors[3];   ///< (w, h) pairs of the stride 8, 16 and 32 heads
+
+        // the builder keeps the parsed graph and weights alive for every runtime of the pool
+        std::unique_ptr<ppl::nn::Engine> x86_engine;
+        std::unique_ptr<ppl::nn::RuntimeBuilder> builder;
+
+        // num_runtimes runtimes from init, plus up to shape_cache_runtimes created for shapes none of them had
+        std::vector<std::unique_ptr<RuntimeContext>> runtime_pool;
+        std::vector<RuntimeContext*> idle_runtimes;
+        std::vector<std::vector<int>> runtime_cpus;   ///< cores of the i-th runtime of init, extra runtimes reuse them in turn
+        int busy_runtimes;       ///< callers holding or creating a runtime, at most num_runtimes
+        int pending_runtimes;    ///< runtimes being created outside the lock
+        uint64_t acquire_clock;
+        std::mutex pool_mutex;
+        std::condition_variable pool_cond;
+        std::mutex builder_mutex;    ///< CreateRuntime calls on the shared builder
+
+        DetectStats stats;
+
+        // byte identical inputs under the same thresholds share their results
+        std::unique_ptr<ResultCache> result_cache;
+        uint64_t cache_seed;     ///< hash of every setting the results depend on
+
+        RuntimeContext* acquire_runtime(const int batch, const int height, const int width);
+        void release_runtime(RuntimeContext* context);
+
+        void input_shape_for(const cv::Mat& src, int* height, int* width) const;
+        uint64_t image_key(const cv::Mat& src) const;
+        ppl::common::RetCode create_builder();
+        ppl::common::RetCode create_runtime(const std::vector<int>& cpus, const int batch, const int height,
+                                            const int width, std::unique_ptr<RuntimeContext>* context);
+        ppl::common::RetCode warm_up();
+        uint64_t scratch_bytes_for(const int height, const int width) const;
+        ppl::common::RetCode resolve_cpus(std::vector<int>* cpus) const;
+        ppl::common::RetCode reshape_input(RuntimeContext* context, const int batch, const int height, const int width);
+        ppl::common::RetCode preprocess(cv::Mat& src, RuntimeContext* context, const int batch_index);
+        ppl::common::RetCode run_network(RuntimeContext* context);
+        ppl::common::RetCode resolve_output_layout(RuntimeContext* context) const;
+        int decode_raw_heads(RuntimeContext* context, const int batch_index, float* boxes, float* scores, int* labels);
+        int decode_fused(RuntimeContext* context, const int batch_index, float* boxes, float* scores, int* labels);
+        int decode_parallel(RuntimeContext* context, const int batch_index, float* boxes, float* scores, int* labels);
+        ppl::common::RetCode postprecess(RuntimeContext* context, const int batch_index, std::vector<DetectRes>& detect_res);
+        ppl::common::RetCode postprecess(RuntimeContext* context, const int batch_index, Detections& detections);
 
-        ppl::common::RetCode preprocess(cv::Mat& src, float* in_data);
-        ppl::common::RetCode postprecess(std::vector<DetectRes>& detect_res);
+        template <typename Result>
+        ppl::common::RetCode detect_single(cv::Mat& src, Result& result);
+        template <typename Result>
+        ppl::common::RetCode detect_cached(cv::Mat& src, Result& result);
+        template <typename Result>
+        ppl::common::RetCode detect_batch(std::vector<cv::Mat>& srcs, std::vector<Result>& results);
 };
 
 
@@ -0,0 +1,64 @@
+#ifndef __YOLOV5_PPL_NN_YOLOV5_CLIENT_H__
+#define __YOLOV5_PPL_NN_YOLOV5_CLIENT_H__
+/**********************************************************
+* \file yolov5_client.h
+* \brief Hand frames to a Yolov5Server through shared memory slots
+***********************************************************/
+
+#include <stdint.h>
+#include <vector>
+
+#include "ppl/common/retcode.h"
+#include "yolov5_ipc.h"
+
+/**
+* \brief Connection to a Yolov5Server of the same host
+*
+* Frames are written into one of num_slots shared memory slots and submitted by slot, so
+* several requests can be in flight. A slot must not be written again before the response
+* to its request was received. Not thread safe.
+*/
+class Yolov5Client{
+    public:
+        Yolov5Client() : fd(-1), slots(NULL), num_slots(0), slot_bytes(0), max_batch(0) {}
+        ~Yolov5Client() { close(); }
+
+        Yolov5Client(const Yolov5Client&) = delete;
+        Yolov5Client& operator=(const Yolov5Client&) = delete;
+
+        /**
+        * \brief Connect and share num_slots slots of slot_bytes each, one 1080p BGR frame takes 6220800
+        */
+        ppl::common::RetCode connect(const char* socket_path, const uint32_t num_slots, const uint64_t slot_bytes);
+        void close();
+
+        /**
+        * \brief Where the BGR pixels of the next request on this slot go
+        */
+        uint8_t* get_slot(const uint32_t slot) const { return slot < num_slots ? slots + slot * slot_bytes : NULL; }
+        uint32_t get_num_slots() const { return num_slots; }
+        uint64_t get_slot_bytes() const { return slot_bytes; }
+        uint32_t get_max_batch() const { return max_batch; }
+
+        /**
+        * \brief Ask for the detections of the frame in slot, which the server must answer within budget_us
+        * \param budget_us <= 0 leaves the deadline to the server
+        */
+        ppl::common::RetCode submit(const uint32_t slot, const uint64_t request_id, const int width, const int height,
+                                    const int stride, const int64_t budget_us);
+
+        /**
+        * \brief Block until the next response arrives, in any order of the submitted requests
+        */
+        ppl::common::RetCode receive(IpcResponse* response, std::vector<IpcDetection>* detections);
+
+    private:
+        int fd;
+        uint8_t* slots;
+        uint32_t num_slots;
+        uint64_t slot_bytes;
+        uint32_t max_batch;
+        std::vector<char> message;   ///< receive buffer, large enough for any response
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __YOLOV5_PPL_NN_YOLOV5_IPC_H__
+#define __YOLOV5_PPL_NN_YOLOV5_IPC_H__
+/**********************************************************
+* \file yolov5_ipc.h
+* \brief Messages between Yolov5Server and its clients on one host
+*
+* A client connects to the SOCK_SEQPACKET unix socket of the server and sends an IpcHello
+* together with a memfd holding num_slots frame slots of slot_bytes each, sealed with at least
+* F_SEAL_SHRINK so that it cannot shrink under the mapping of the server. Every IpcRequest
+* then names a slot whose BGR pixels the server reads in place, and is answered by one
+* IpcResponse followed by its IpcDetection records in the same packet. A slot belongs to the
+* server from its request until the response, requests may be answered out of order.
+***********************************************************/
+
+#include <stdint.h>
+#include <time.h>
+
+static const uint32_t kIpcMagic = 0x59495043;    ///< "YIPC"
+static const uint32_t kIpcVersion = 1;
+static const uint32_t kIpcMaxDetections = 1024;  ///< detections per response, the highest scored ones are kept
+
+enum IpcStatus{
+    IPC_OK = 0,
+    IPC_EXPIRED = 1,         ///< the deadline passed before the request got into a batch
+    IPC_OVERLOADED = 2,      ///< the server queue was full
+    IPC_INVALID = 3,         ///< malformed request, slot or frame out of bounds
+    IPC_FAILED = 4,          ///< the detector returned an error
+};
+
+struct IpcHello{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t reserved;
+    uint64_t slot_bytes;     ///< every slot starts at slot * slot_bytes of the memfd
+};
+
+struct IpcHelloReply{
+    uint32_t magic;
+    uint32_t status;         ///< IPC_OK when the slots were mapped
+    uint32_t max_batch;      ///< images the server runs together at most
+    uint32_t max_detections; ///< detections per response at most
+};
+
+struct IpcRequest{
+    uint64_t request_id;     ///< echoed in the response
+    uint32_t slot;
+    int32_t width;
+    int32_t height;
+    int32_t stride;          ///< bytes per row, at least width * 3
+    int64_t deadline_ns;     ///< CLOCK_MONOTONIC time after which the result is useless, 0 for none
+};
+
+struct IpcResponse{
+    uint64_t request_id;
+    uint32_t status;         ///< IpcStatus
+    uint32_t num_detections; ///< IpcDetection records following this header
+    uint32_t batch_size;     ///< images of the batch the request ran in
+    uint32_t reserved;
+    int64_t queue_ns;        ///< arrival to the start of its batch
+    int64_t detect_ns;       ///< duration of the batch
+};
+
+struct IpcDetection{
+    float x1;
+    float y1;
+    float x2;
+    float y2;
+    float score;
+    int32_t label;
+};
+
+/**
+* \brief The clock of deadline_ns, shared by every process of the host
+*/
+inline int64_t ipc_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
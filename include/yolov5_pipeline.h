@@ -0,0 +1,132 @@
+#ifndef __YOLOV5_PPL_NN_YOLOV5_PIPELINE_H__
+#define __YOLOV5_PPL_NN_YOLOV5_PIPELINE_H__
+/**********************************************************
+* \file yolov5_pipeline.h
+* \brief Run preprocess, network and postprocess of consecutive frames concurrently
+***********************************************************/
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spsc_queue.h"
+#include "yolov5.h"
+
+/**
+* \brief Three stage pipeline on top of a Yolov5Impl
+*
+* Each stage runs on its own thread and the stages are connected by bounded
+* lock-free queues, so frame k+1 is preprocessed and frame k-1 is decoded while
+* frame k is in the network. A frame holds one runtime of the pool from preprocess
+* until its results are decoded, so the Yolov5Impl should be created with
+* num_runtimes >= 3 to keep all stages busy.
+*/
+class Yolov5Pipeline{
+    public:
+        /**
+        * \param impl an initialized detector which must outlive the pipeline
+        * \param queue_depth the capacity of every queue between two stages
+        */
+        explicit Yolov5Pipeline(Yolov5Impl* impl, const int queue_depth = 4);
+
+        /**
+        * \brief Finishes all submitted frames, then joins the stage threads
+        */
+        ~Yolov5Pipeline();
+
+        /**
+        * \brief Queue one frame, blocks while the first queue is full
+        *
+        * The pixels of src are not copied, so they must stay unchanged until the future is ready.
+        * A failing stage stores a std::runtime_error in the future.
+        */
+        std::future<std::vector<DetectRes>> submit(const cv::Mat& src);
+
+    private:
+        struct PipelineTask{
+            cv::Mat src;
+            RuntimeContext* context;
+            std::promise<std::vector<DetectRes>> promise;
+        };
+
+        /**
+        * \brief Parks the threads on either side of a queue once spinning on it stopped paying off
+        *
+        * notify only takes the mutex when a thread is parked, so busy stages never touch it.
+        */
+        class StageSignal{
+            public:
+                StageSignal() : waiters(0) {}
+
+                /**
+                * \brief Return once ready() is true, ready is re-evaluated after every notify
+                */
+                template <typename Ready>
+                void wait(Ready ready) {
+                    for (int spins = 0; spins < 64; ++spins) {
+                        if (ready())
+                            return;
+                        std::this_thread::yield();
+                    }
+
+                    std::unique_lock<std::mutex> lock(mutex);
+                    waiters.fetch_add(1);
+                    while (!ready())
+                        cond.wait(lock);
+                    waiters.fetch_sub(1);
+                }
+
+                /**
+                * \brief Call after every change ready() of a waiter may depend on
+                */
+                void notify() {
+                    // orders the change before the load, pairs with the increment in wait
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (waiters.load(std::memory_order_relaxed) == 0)
+                        return;
+
+                    { std::lock_guard<std::mutex> lock(mutex); }
+                    cond.notify_all();
+                }
+
+            private:
+                std::mutex mutex;
+                std::condition_variable cond;
+                std::atomic<int> waiters;
+        };
+
+        Yolov5Impl* impl;
+
+        SpscQueue<PipelineTask*> preprocess_queue;
+        SpscQueue<PipelineTask*> run_queue;
+        SpscQueue<PipelineTask*> postprocess_queue;
+
+        StageSignal preprocess_signal;  ///< pushes and pops of preprocess_queue, and stopping
+        StageSignal run_signal;         ///< pushes and pops of run_queue, and preprocess_done
+        StageSignal postprocess_signal; ///< pushes and pops of postprocess_queue, and run_done
+
+        std::atomic<bool> stopping;
+        std::atomic<bool> preprocess_done;
+        std::atomic<bool> run_done;
+
+        std::mutex submit_mutex;   ///< submit may be called from several threads, the queue has one producer
+
+        std::thread preprocess_thread;
+        std::thread run_thread;
+        std::thread postprocess_thread;
+
+        void preprocess_loop();
+        void run_loop();
+        void postprocess_loop();
+
+        void fail_task(PipelineTask* task, ppl::common::RetCode retcode);
+
+        static void push_blocking(SpscQueue<PipelineTask*>& queue, StageSignal& signal, PipelineTask* task);
+        static PipelineTask* pop_blocking(SpscQueue<PipelineTask*>& queue, StageSignal& signal,
+                                          const std::atomic<bool>& producer_done);
+};
+
+#endif
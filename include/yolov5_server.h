@@ -0,0 +1,116 @@
+#ifndef __YOLOV5_PPL_NN_YOLOV5_SERVER_H__
+#define __YOLOV5_PPL_NN_YOLOV5_SERVER_H__
+/**********************************************************
+* \file yolov5_server.h
+* \brief Serve a Yolov5Impl to local processes with dynamic batching
+***********************************************************/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "yolov5.h"
+#include "yolov5_ipc.h"
+
+struct ServerParams{
+    const char* socket_path;     ///< unix socket to listen on, replaced when it exists
+    int max_batch;               ///< images per Runtime::Run at most
+    int64_t max_wait_us;         ///< how long the oldest queued request waits for its batch to fill
+    int64_t default_budget_us;   ///< deadline of requests which carry none, <= 0 for no deadline
+    int max_queue;               ///< queued requests beyond which new ones are refused, <= 0 is unbounded
+    int num_batchers;            ///< batches in flight at once, useful up to num_runtimes of the detector
+};
+
+/**
+* \brief Snapshot of the request counters of a server
+*/
+struct ServerCounters{
+    uint64_t connections;        ///< clients accepted so far
+    uint64_t requests;           ///< requests received
+    uint64_t completed;          ///< requests answered with detections
+    uint64_t batches;            ///< Runtime::Run calls
+    uint64_t expired;            ///< requests shed because their deadline passed in the queue
+    uint64_t overloaded;         ///< requests refused on a full queue
+    uint64_t invalid;            ///< malformed requests
+    uint64_t failed;             ///< requests of batches the detector failed on
+};
+
+/**
+* \brief Unix socket server batching the frames of many local clients onto one detector
+*
+* One thread accepts clients and one thread per client reads its requests into a shared
+* queue. Batcher threads take up to max_batch requests once the batch is full or the oldest
+* request waited max_wait_us, drop the ones past their deadline and run the rest with one
+* yolov5_network_detect_batch straight from the shared memory of the clients.
+*/
+class Yolov5Server{
+    public:
+        /**
+        * \param impl an initialized detector which must outlive the server
+        */
+        Yolov5Server(Yolov5Impl* impl, const ServerParams& params);
+
+        /**
+        * \brief Same as stop()
+        */
+        ~Yolov5Server();
+
+        /**
+        * \brief Listen on socket_path and start the threads
+        */
+        ppl::common::RetCode start();
+
+        /**
+        * \brief Disconnect every client, drop the queued requests and join the threads
+        */
+        void stop();
+
+        ServerCounters get_counters() const;
+
+    private:
+        struct Connection;
+
+        struct PendingRequest{
+            std::shared_ptr<Connection> connection;
+            IpcRequest request;
+            int64_t arrival_ns;
+            int64_t deadline_ns;     ///< 0 for none
+        };
+
+        Yolov5Impl* impl;
+        ServerParams params;
+
+        int listen_fd;
+        std::thread accept_thread;
+        std::vector<std::shared_ptr<Connection>> connections;
+        std::mutex connections_mutex;
+
+        std::deque<PendingRequest> queue;
+        std::mutex queue_mutex;
+        std::condition_variable queue_cond;
+        bool stopping;
+
+        std::vector<std::thread> batcher_threads;
+
+        std::atomic<uint64_t> num_connections;
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> completed;
+        std::atomic<uint64_t> batches;
+        std::atomic<uint64_t> expired;
+        std::atomic<uint64_t> overloaded;
+        std::atomic<uint64_t> invalid;
+        std::atomic<uint64_t> failed;
+
+        void accept_loop();
+        void connection_loop(std::shared_ptr<Connection> connection);
+        void batcher_loop();
+
+        bool take_batch(std::vector<PendingRequest>* batch, std::vector<PendingRequest>* expired_requests);
+        void respond(Connection* connection, const IpcResponse& response, const Detections* detections);
+};
+
+#endif
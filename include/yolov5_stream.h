@@ -0,0 +1,134 @@
+#ifndef __YOLOV5_PPL_NN_YOLOV5_STREAM_H__
+#define __YOLOV5_PPL_NN_YOLOV5_STREAM_H__
+/**********************************************************
+* \file yolov5_stream.h
+* \brief Detect on a decoded video stream with bounded latency
+***********************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include "yolov5.h"
+
+/**
+* \brief What the decoder does with a new frame when the ring is full
+*/
+enum StreamDropPolicy{
+    STREAM_DROP_OLDEST = 0,  ///< replace the oldest queued frame, latency stays bounded by the ring
+    STREAM_DROP_NEWEST = 1,  ///< discard the new frame, queued frames keep their place
+    STREAM_BLOCK = 2,        ///< stop decoding until a worker takes a frame, nothing is lost
+};
+
+struct StreamParams{
+    int capacity;                ///< frames the ring holds between the decoder and the workers
+    StreamDropPolicy drop_policy;
+    int num_workers;             ///< threads calling yolov5_network_detect, at most num_runtimes are busy at once
+    bool realtime;               ///< pace the decoder at the frame rate of the source, like a live camera
+    int64_t latency_budget_us;   ///< frames queued longer than this are dropped before inference, <= 0 disables
+};
+
+/**
+* \brief Snapshot of the frame counters of a stream
+*/
+struct StreamCounters{
+    uint64_t decoded;            ///< frames read from the source
+    uint64_t processed;          ///< frames with delivered results
+    uint64_t dropped_full;       ///< frames dropped by drop_policy on a full ring
+    uint64_t dropped_stale;      ///< frames dropped for exceeding latency_budget_us
+    uint64_t failed;             ///< frames the detector returned an error for
+};
+
+struct StreamResult{
+    int64_t frame_index;         ///< position in the source, dropped frames included
+    double stream_time_ms;       ///< presentation time reported by the decoder
+    std::chrono::steady_clock::time_point capture_time;   ///< when the decoder handed the frame over
+    double queue_us;             ///< capture to the start of inference
+    double latency_us;           ///< capture to result
+    uint64_t dropped;            ///< frames dropped so far, by either reason
+    cv::Mat frame;               ///< the decoded BGR frame, a copy kept past the callback stays valid
+    std::vector<DetectRes> detect_res;   ///< in frame coordinates
+};
+
+/**
+* \brief Decoder thread feeding a bounded ring of frames drained by detection workers
+*
+* Results are handed to the callback on the worker threads as soon as they are ready,
+* with several workers they may arrive out of frame order and concurrently.
+*/
+class Yolov5Stream{
+    public:
+        typedef std::function<void(StreamResult& result)> ResultCallback;
+
+        /**
+        * \param impl an initialized detector which must outlive the stream
+        */
+        Yolov5Stream(Yolov5Impl* impl, const StreamParams& params, ResultCallback on_result);
+
+        /**
+        * \brief Same as stop()
+        */
+        ~Yolov5Stream();
+
+        /**
+        * \brief Open a video file, a stream url or a camera index given as digits and start the threads
+        */
+        ppl::common::RetCode start(const char* source);
+
+        /**
+        * \brief Block until the source ended and every queued frame was processed
+        */
+        void wait();
+
+        /**
+        * \brief Stop decoding, discard the queued frames and join the threads
+        */
+        void stop();
+
+        StreamCounters get_counters() const;
+
+    private:
+        struct StreamFrame{
+            cv::Mat image;
+            int64_t index;
+            double stream_time_ms;
+            std::chrono::steady_clock::time_point capture_time;
+        };
+
+        Yolov5Impl* impl;
+        StreamParams params;
+        ResultCallback on_result;
+
+        cv::VideoCapture capture;
+
+        std::deque<StreamFrame> ring;
+        std::vector<cv::Mat> free_images;   ///< buffers of consumed frames, decoded into again
+        std::mutex ring_mutex;
+        std::condition_variable ring_not_empty;
+        std::condition_variable ring_not_full;
+        bool decode_done;
+        bool stopping;
+
+        std::atomic<uint64_t> decoded;
+        std::atomic<uint64_t> processed;
+        std::atomic<uint64_t> dropped_full;
+        std::atomic<uint64_t> dropped_stale;
+        std::atomic<uint64_t> failed;
+
+        std::thread decode_thread;
+        std::vector<std::thread> worker_threads;
+
+        void decode_loop();
+        void worker_loop();
+
+        void push_frame(StreamFrame& frame);
+        void recycle_image(cv::Mat& image);
+};
+
+#endif
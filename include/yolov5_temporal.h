@@ -0,0 +1,80 @@
+#ifndef __YOLOV5_PPL_NN_YOLOV5_TEMPORAL_H__
+#define __YOLOV5_PPL_NN_YOLOV5_TEMPORAL_H__
+/**********************************************************
+* \file yolov5_temporal.h
+* \brief Skip inference on frames of a static camera which did not change
+***********************************************************/
+
+#include <atomic>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include "yolov5.h"
+
+struct TemporalParams{
+    int grid_width;              ///< columns of the change grid, every cell is the mean gray level of its pixels
+    int grid_height;             ///< rows of the change grid
+    float cell_threshold;        ///< mean gray level difference, 0 to 255, above which a cell counts as changed
+    int max_changed_cells;       ///< frames with at most this many changed cells reuse the last results
+    int keyframe_interval;       ///< run the network at least every K frames, <= 1 runs it on every frame
+};
+
+/**
+* \brief Snapshot of the frame counters of a temporal detector
+*/
+struct TemporalCounters{
+    uint64_t frames;             ///< frames passed to detect
+    uint64_t inferred;           ///< frames which ran the network
+    uint64_t skipped;            ///< frames answered with the results of the last inferred frame
+
+    double get_skip_ratio() const { return frames ? (double)skipped / frames : 0.0; }
+};
+
+/**
+* \brief Gates yolov5_network_detect on a cheap change metric, for one camera of a fixed view
+*
+* Every frame is reduced to a grid_width x grid_height grid of sampled gray means and compared
+* with the grid of the last frame which ran the network, so slow drift still adds up to a change.
+* Quiet frames get a copy of the last results, every keyframe_interval frames and on any
+* change of resolution the network runs regardless. One instance per stream, calls must not
+* overlap; the detector itself may be shared by many instances.
+*/
+class Yolov5Temporal{
+    public:
+        /**
+        * \param impl an initialized detector which must outlive this object
+        */
+        Yolov5Temporal(Yolov5Impl* impl, const TemporalParams& params);
+
+        /**
+        * \brief Detect on src or reuse the last results, skipped is set when the network did not run
+        */
+        ppl::common::RetCode detect(cv::Mat& src, std::vector<DetectRes>& detect_res, bool* skipped);
+
+        /**
+        * \brief Forget the reference frame, the next frame runs the network, e.g. after the camera moved
+        */
+        void reset();
+
+        TemporalCounters get_counters() const;
+
+    private:
+        Yolov5Impl* impl;
+        TemporalParams params;
+
+        std::vector<float> reference_grid;   ///< grid of the last frame which ran the network
+        std::vector<float> grid;             ///< grid of the current frame
+        std::vector<DetectRes> last_res;     ///< results of the last frame which ran the network
+        cv::Size reference_size;
+        bool has_reference;
+        int frames_since_inference;
+
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> inferred;
+        std::atomic<uint64_t> skipped;
+
+        void compute_grid(const cv::Mat& src, float* cells) const;
+        int count_changed_cells() const;
+};
+
+#endif
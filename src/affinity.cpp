@@ -0,0 +1,133 @@
+#include "affinity.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+bool parse_cpu_list(const char* cpu_list, std::vector<int>* cpus) {
+    cpus->clear();
+    if (cpu_list == NULL)
+        return false;
+
+    const char* p = cpu_list;
+    while (*p && *p != '\n') {
+        char* end = NULL;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+            p = end;
+        }
+        if (last >= CPU_SETSIZE)
+            return false;
+
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus->push_back(static_cast<int>(cpu));
+
+        if (*p == ',')
+            ++p;
+        else if (*p && *p != '\n')
+            return false;
+    }
+
+    return !cpus->empty();
+}
+
+bool read_numa_node_cpus(const int numa_node, std::vector<int>* cpus) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numa_node);
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+        return false;
+
+    char cpu_list[4096];
+    bool ok = fgets(cpu_list, sizeof(cpu_list), fp) != NULL && parse_cpu_list(cpu_list, cpus);
+    fclose(fp);
+    return ok;
+}
+
+void split_cpus(const std::vector<int>& cpus, const int num_parts, const int cores_per_part,
+                std::vector<std::vector<int>>* parts) {
+    parts->assign(num_parts, std::vector<int>());
+    if (cpus.empty())
+        return;
+
+    if (cores_per_part <= 0 || static_cast<size_t>(num_parts) * cores_per_part > cpus.size()) {
+        parts->assign(num_parts, cpus);
+        return;
+    }
+
+    for (int i = 0; i < num_parts; ++i)
+        (*parts)[i].assign(cpus.begin() + i * cores_per_part, cpus.begin() + (i + 1) * cores_per_part);
+}
+
+static bool set_affinity(const cpu_set_t& cpu_set) {
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_setaffinity_np failed: %s\n", strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+bool bind_current_thread(const std::vector<int>& cpus, const int num_threads) {
+#ifdef _OPENMP
+    if (num_threads > 0)
+        omp_set_num_threads(num_threads);
+#else
+    (void)num_threads;
+#endif
+
+    if (cpus.empty())
+        return true;
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &cpu_set);
+
+    if (!set_affinity(cpu_set))
+        return false;
+
+#ifdef _OPENMP
+    // workers of the calling thread's team are reused by the kernels, they keep whatever mask they had
+    // when they were spawned, so every one of them pins itself here
+    bool ok = true;
+#pragma omp parallel reduction(&& : ok)
+    ok = set_affinity(cpu_set);
+    return ok;
+#else
+    return true;
+#endif
+}
+
+bool ensure_current_thread_bound(const std::vector<int>& cpus, const int num_threads) {
+    if (cpus.empty() && num_threads <= 0)
+        return true;
+
+    // the binding this thread got last, by value, so another detector on the same cores shares it
+    static thread_local bool bound = false;
+    static thread_local std::vector<int> bound_cpus;
+    static thread_local int bound_num_threads = 0;
+    if (bound && bound_num_threads == num_threads && bound_cpus == cpus)
+        return true;
+
+    bound = bind_current_thread(cpus, num_threads);
+    bound_cpus = cpus;
+    bound_num_threads = num_threads;
+    return bound;
+}
@@ -0,0 +1,106 @@
+#include "cpu_isa.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef YOLOV5_X86_DISPATCH
+#include <cpuid.h>
+#endif
+
+static const char* kIsaNames[] = {"scalar", "sse2", "avx2", "avx512"};
+
+#ifdef YOLOV5_X86_DISPATCH
+// XCR0, which register state the OS saves on a context switch
+static uint64_t read_xcr0() {
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+}
+#endif
+
+static CpuIsa detect_host_cpu_isa() {
+#ifdef YOLOV5_X86_DISPATCH
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return CPU_ISA_SCALAR;
+
+    const bool sse2 = (edx & bit_SSE2) != 0;
+    const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+    const bool avx = (ecx & bit_AVX) != 0;
+    if (!sse2)
+        return CPU_ISA_SCALAR;
+    if (!osxsave || !avx)
+        return CPU_ISA_SSE2;
+
+    // xmm and ymm state for AVX2, plus the opmask and both halves of zmm0-31 for AVX-512
+    const uint64_t xcr0 = read_xcr0();
+    const bool ymm_state = (xcr0 & 0x6) == 0x6;
+    const bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+    if (!ymm_state || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return CPU_ISA_SSE2;
+
+    if ((ebx & bit_AVX512F) && zmm_state)
+        return CPU_ISA_AVX512;
+    if (ebx & bit_AVX2)
+        return CPU_ISA_AVX2;
+    return CPU_ISA_SSE2;
+#elif defined(__SSE2__)
+    return CPU_ISA_SSE2;
+#else
+    return CPU_ISA_SCALAR;
+#endif
+}
+
+CpuIsa get_host_cpu_isa() {
+    static const CpuIsa host_isa = detect_host_cpu_isa();
+    return host_isa;
+}
+
+static CpuIsa initial_cpu_isa() {
+    CpuIsa isa = get_host_cpu_isa();
+    const char* name = getenv("YOLOV5_CPU_ISA");
+    if (name == NULL)
+        return isa;
+
+    CpuIsa requested;
+    if (!parse_cpu_isa(name, &requested)) {
+        fprintf(stderr, "ignoring unknown YOLOV5_CPU_ISA %s\n", name);
+        return isa;
+    }
+    return requested < isa ? requested : isa;
+}
+
+static std::atomic<int>& active_cpu_isa() {
+    static std::atomic<int> isa(initial_cpu_isa());
+    return isa;
+}
+
+CpuIsa get_cpu_isa() {
+    return static_cast<CpuIsa>(active_cpu_isa().load(std::memory_order_relaxed));
+}
+
+CpuIsa set_cpu_isa(const CpuIsa isa) {
+    const CpuIsa host_isa = get_host_cpu_isa();
+    const CpuIsa used = isa < host_isa ? isa : host_isa;
+    active_cpu_isa().store(used, std::memory_order_relaxed);
+    return used;
+}
+
+const char* get_cpu_isa_name(const CpuIsa isa) {
+    if (isa < CPU_ISA_SCALAR || isa > CPU_ISA_AVX512)
+        return "unknown";
+    return kIsaNames[isa];
+}
+
+bool parse_cpu_isa(const char* name, CpuIsa* isa) {
+    for (int i = CPU_ISA_SCALAR; i <= CPU_ISA_AVX512; ++i) {
+        if (strcmp(name, kIsaNames[i]) == 0) {
+            *isa = static_cast<CpuIsa>(i);
+            return true;
+        }
+    }
+    return false;
+}
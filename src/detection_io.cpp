@@ -0,0 +1,198 @@
+#include "detection_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ppl::common;
+
+static const char kMagic[4] = {'Y', 'D', 'E', 'T'};
+static const uint32_t kVersion = 1;
+static const size_t kFileHeaderBytes = 8;
+static const size_t kRecordHeaderBytes = 16;
+
+// a record at position whose header reads record_bytes and count, complete within a file of size bytes
+static bool is_complete_record(const uint32_t record_bytes, const uint32_t count, const uint64_t position,
+                               const uint64_t size) {
+    const uint64_t expected_bytes = kRecordHeaderBytes - sizeof(uint32_t) +
+                                    (uint64_t)count * (5 * sizeof(float) + sizeof(int32_t));
+    return record_bytes == expected_bytes && position + sizeof(uint32_t) + record_bytes <= size;
+}
+
+// end of the last complete record, the size of the file unless a crashed writer left a torn one behind
+static uint64_t find_complete_end(FILE* fp, const uint64_t size) {
+    uint64_t position = kFileHeaderBytes;
+    while (position + kRecordHeaderBytes <= size) {
+        uint32_t header[2];
+        if (fseek(fp, position, SEEK_SET) != 0 || fread(header, sizeof(header), 1, fp) != 1 ||
+            !is_complete_record(header[0], header[1], position, size))
+            break;
+        position += sizeof(uint32_t) + header[0];
+    }
+    return position;
+}
+
+RetCode DetectionWriter::open(const char* path, const bool append) {
+    close();
+
+    fp = fopen(path, append ? "a+b" : "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "cannot open %s for writing\n", path);
+        return RC_INVALID_VALUE;
+    }
+
+    // a new or empty file gets the header, an existing one has to carry ours
+    fseek(fp, 0, SEEK_END);
+    const long file_bytes = ftell(fp);
+    if (file_bytes == 0) {
+        fwrite(kMagic, 1, sizeof(kMagic), fp);
+        fwrite(&kVersion, sizeof(kVersion), 1, fp);
+    } else {
+        char header[kFileHeaderBytes] = {0};
+        uint32_t version = 0;
+        fseek(fp, 0, SEEK_SET);
+        const bool read_ok = fread(header, 1, sizeof(header), fp) == sizeof(header);
+        memcpy(&version, header + sizeof(kMagic), sizeof(version));
+        if (!read_ok || memcmp(header, kMagic, sizeof(kMagic)) != 0 || version != kVersion) {
+            fprintf(stderr, "%s is not a detection file of version %u\n", path, kVersion);
+            close();
+            return RC_INVALID_VALUE;
+        }
+
+        // frames appended after a torn record would never be read, the reader stops at it
+        const uint64_t end = find_complete_end(fp, file_bytes);
+        if (end < (uint64_t)file_bytes) {
+            fprintf(stderr, "%s: dropping %lu bytes of a record cut short\n", path,
+                    (unsigned long)(file_bytes - end));
+            if (ftruncate(fileno(fp), end) != 0) {
+                fprintf(stderr, "cannot truncate %s: %s\n", path, strerror(errno));
+                close();
+                return RC_OTHER_ERROR;
+            }
+        }
+        fseek(fp, 0, SEEK_END);
+    }
+
+    file_buffer.resize(1 << 20);
+    setvbuf(fp, file_buffer.data(), _IOFBF, file_buffer.size());
+    return RC_SUCCESS;
+}
+
+RetCode DetectionWriter::write_frame(const uint64_t frame_id, const Detections& detections) {
+    if (fp == NULL)
+        return RC_INVALID_VALUE;
+
+    const uint32_t count = detections.size();
+    const uint32_t record_bytes = kRecordHeaderBytes - sizeof(uint32_t) + count * (5 * sizeof(float) + sizeof(int32_t));
+
+    bool ok = fwrite(&record_bytes, sizeof(record_bytes), 1, fp) == 1 &&
+              fwrite(&count, sizeof(count), 1, fp) == 1 &&
+              fwrite(&frame_id, sizeof(frame_id), 1, fp) == 1;
+    if (ok && count) {
+        ok = fwrite(detections.x1.data(), sizeof(float), count, fp) == count &&
+             fwrite(detections.y1.data(), sizeof(float), count, fp) == count &&
+             fwrite(detections.x2.data(), sizeof(float), count, fp) == count &&
+             fwrite(detections.y2.data(), sizeof(float), count, fp) == count &&
+             fwrite(detections.score.data(), sizeof(float), count, fp) == count &&
+             fwrite(detections.label.data(), sizeof(int32_t), count, fp) == count;
+    }
+    if (!ok) {
+        fprintf(stderr, "write frame %lu failed\n", (unsigned long)frame_id);
+        return RC_OTHER_ERROR;
+    }
+
+    return RC_SUCCESS;
+}
+
+RetCode DetectionWriter::flush() {
+    if (fp == NULL || fflush(fp) != 0)
+        return RC_OTHER_ERROR;
+    return RC_SUCCESS;
+}
+
+void DetectionWriter::close() {
+    if (fp) {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+RetCode DetectionReader::open(const char* path) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Not found %s\n", path);
+        return RC_NOT_FOUND;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)kFileHeaderBytes) {
+        ::close(fd);
+        fprintf(stderr, "%s is not a detection file\n", path);
+        return RC_INVALID_VALUE;
+    }
+
+    void* mapped = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "mmap %s failed\n", path);
+        return RC_OTHER_ERROR;
+    }
+    madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+
+    data = static_cast<const char*>(mapped);
+    size = file_stat.st_size;
+
+    uint32_t version = 0;
+    memcpy(&version, data + sizeof(kMagic), sizeof(version));
+    if (memcmp(data, kMagic, sizeof(kMagic)) != 0 || version != kVersion) {
+        fprintf(stderr, "%s is not a detection file of version %u\n", path, kVersion);
+        close();
+        return RC_INVALID_VALUE;
+    }
+
+    position = kFileHeaderBytes;
+    return RC_SUCCESS;
+}
+
+bool DetectionReader::next(DetectionFrameView* view) {
+    if (data == NULL || position + kRecordHeaderBytes > size)
+        return false;
+
+    uint32_t record_bytes, count;
+    memcpy(&record_bytes, data + position, sizeof(record_bytes));
+    memcpy(&count, data + position + 4, sizeof(count));
+    if (!is_complete_record(record_bytes, count, position, size))
+        return false;
+
+    memcpy(&view->frame_id, data + position + 8, sizeof(view->frame_id));
+    view->count = count;
+
+    const float* arrays = reinterpret_cast<const float*>(data + position + kRecordHeaderBytes);
+    view->x1    = arrays;
+    view->y1    = arrays + count;
+    view->x2    = arrays + 2 * count;
+    view->y2    = arrays + 3 * count;
+    view->score = arrays + 4 * count;
+    view->label = reinterpret_cast<const int32_t*>(arrays + 5 * count);
+
+    position += sizeof(uint32_t) + record_bytes;
+    return true;
+}
+
+void DetectionReader::rewind() {
+    position = data ? kFileHeaderBytes : 0;
+}
+
+void DetectionReader::close() {
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+        data = NULL;
+    }
+    size = 0;
+    position = 0;
+}
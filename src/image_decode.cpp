@@ -0,0 +1,104 @@
+#include "image_decode.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace ppl::common;
+
+static inline int read_be16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// size of a dimension after libjpeg DCT scaling, which rounds up
+static inline int scaled_size(const int size, const int denom) {
+    return (size + denom - 1) / denom;
+}
+
+bool read_jpeg_size(const uint8_t* data, const uint64_t size, int* width, int* height) {
+    if (data == NULL || size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    uint64_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF)
+            return false;
+
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) { // fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) { // markers without a length
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xDA) // start of scan, the frame header would have come before
+            return false;
+
+        const int length = read_be16(data + pos + 2);
+        if (length < 2)
+            return false;
+
+        // SOF0 to SOF15 apart from DHT, JPG and DAC which share the range
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > size || length < 7)
+                return false;
+            *height = read_be16(data + pos + 5);
+            *width  = read_be16(data + pos + 7);
+            return *width > 0 && *height > 0;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+int choose_jpeg_scale_denom(const int width, const int height, const int target_width, const int target_height) {
+    if (width <= 0 || height <= 0 || target_width <= 0 || target_height <= 0)
+        return 1;
+
+    // the same fit as the letterbox of preprocess
+    const float scale = std::min(static_cast<float>(target_width) / width, static_cast<float>(target_height) / height);
+    const int resized_width = static_cast<int>(roundf(width * scale));
+    const int resized_height = static_cast<int>(roundf(height * scale));
+
+    static const int denoms[] = {8, 4, 2};
+    for (int denom : denoms) {
+        if (scaled_size(width, denom) >= resized_width && scaled_size(height, denom) >= resized_height)
+            return denom;
+    }
+    return 1;
+}
+
+RetCode decode_image(const uint8_t* data, const uint64_t size, const int target_width, const int target_height,
+                     cv::Mat* image, float* scale_x, float* scale_y) {
+    if (data == NULL || size == 0 || image == NULL || scale_x == NULL || scale_y == NULL)
+        return RC_INVALID_VALUE;
+
+    int width = 0, height = 0;
+    int denom = 1;
+    if (read_jpeg_size(data, size, &width, &height))
+        denom = choose_jpeg_scale_denom(width, height, target_width, target_height);
+
+    // libjpeg scales while it decodes, so the full size image never exists
+    static const int flags[] = {cv::IMREAD_COLOR, cv::IMREAD_REDUCED_COLOR_2, 0, cv::IMREAD_REDUCED_COLOR_4,
+                                0, 0, 0, cv::IMREAD_REDUCED_COLOR_8};
+    const cv::Mat encoded(1, static_cast<int>(size), CV_8UC1, const_cast<uint8_t*>(data));
+    *image = cv::imdecode(encoded, flags[denom - 1]);
+    if (image->empty()) {
+        fprintf(stderr, "cannot decode image of %lu bytes\n", (unsigned long)size);
+        return RC_INVALID_VALUE;
+    }
+
+    *scale_x = 1.f;
+    *scale_y = 1.f;
+    if (denom == 1)
+        return RC_SUCCESS;
+
+    // EXIF orientation may have swapped the axes of the decoded image
+    if (image->cols == scaled_size(height, denom) && image->rows == scaled_size(width, denom) &&
+        image->cols != image->rows)
+        std::swap(width, height);
+    *scale_x = static_cast<float>(width) / image->cols;
+    *scale_y = static_cast<float>(height) / image->rows;
+    return RC_SUCCESS;
+}
@@ -16,11 +16,19 @@
 // under the License.
 
 #include "mmcv_nms.h"
+#include "cpu_isa.h"
 
 #include <vector>
 #include <algorithm>
 #include <numeric>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef YOLOV5_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 // refer to https://github.com/openppl-public/ppl.nn/blob/master/src/ppl/nn/engines/x86/impls/src/ppl/kernel/x86/fp32/mmcv_nms/mmcv_nms_fp32.cpp
@@ -38,6 +46,18 @@ inline void argsort(const DataType *src, IndexType *indices, const int64_t lengt
     }
 }
 
+// same order as argsort(src, indices, length) but without the temporary buffer of stable_sort
+template <typename DataType, typename IndexType>
+inline void argsort_desc(const DataType *src, IndexType *indices, const int64_t length)
+{
+    for (int64_t i = 0; i < length; ++i)
+        indices[i] = static_cast<IndexType>(i);
+    std::sort(indices, indices + length,
+        [&src](const IndexType &ind0, const IndexType &ind1) {
+            return src[ind0] > src[ind1] || (src[ind0] == src[ind1] && ind0 < ind1);
+        });
+}
+
 inline float calc_iou(
         const float *boxes,
         const float *areas,
@@ -101,6 +121,265 @@ ppl::common::RetCode mmcv_nms_ndarray_fp32_naive(
     return ppl::common::RC_SUCCESS;
 }
 
+/**
+* \brief Boxes sorted by descending score in SoA layout, padded with empty boxes to a multiple of 4
+*
+* A view into temp_buffer, which holds get_buffer_bytes(num_boxes) bytes.
+*/
+struct SortedBoxes {
+    uint32_t *index;
+    float *x1, *y1, *x2, *y2, *areas;
+
+    static uint64_t get_buffer_bytes(const uint32_t num_boxes)
+    {
+        const uint64_t padded = (num_boxes + 3) & ~3u;
+        return padded * sizeof(uint32_t) + 5 * padded * sizeof(float);
+    }
+
+    SortedBoxes(const float *boxes, const float *scores, const uint32_t num_boxes, const int64_t offset,
+                void *temp_buffer)
+    {
+        const uint32_t padded = (num_boxes + 3) & ~3u;
+        index = static_cast<uint32_t *>(temp_buffer);
+        x1 = reinterpret_cast<float *>(index + padded);
+        y1 = x1 + padded;
+        x2 = y1 + padded;
+        y2 = x2 + padded;
+        areas = y2 + padded;
+        std::fill(x1, x1 + 5 * padded, 0.f);
+
+        argsort_desc(scores, index, num_boxes);
+        for (uint32_t i = 0; i < num_boxes; i++) {
+            const float *box = boxes + index[i] * 4;
+            x1[i] = box[0];
+            y1[i] = box[1];
+            x2[i] = box[2];
+            y2[i] = box[3];
+            areas[i] = (box[2] - box[0] + offset) * (box[3] - box[1] + offset);
+        }
+    }
+};
+
+// same arithmetic as calc_iou, so that both agree bit for bit
+inline float calc_iou_soa(const SortedBoxes &b, const uint32_t i0, const uint32_t i1, const int64_t offset)
+{
+    float xx1 = max(b.x1[i0], b.x1[i1]);
+    float yy1 = max(b.y1[i0], b.y1[i1]);
+    float xx2 = min(b.x2[i0], b.x2[i1]);
+    float yy2 = min(b.y2[i0], b.y2[i1]);
+
+    float w = max(0.f, xx2 - xx1 + offset);
+    float h = max(0.f, yy2 - yy1 + offset);
+
+    float inter = w * h;
+    return inter / (b.areas[i0] + b.areas[i1] - inter);
+}
+
+// bit k is set when IoU(box i, box j + k) >= iou_threshold
+inline int calc_iou_mask4(
+        const SortedBoxes &b,
+        const uint32_t i,
+        const uint32_t j,
+        const int64_t offset,
+        const float iou_threshold)
+{
+#if defined(__SSE2__)
+    const __m128 xx1 = _mm_max_ps(_mm_set1_ps(b.x1[i]), _mm_loadu_ps(&b.x1[j]));
+    const __m128 yy1 = _mm_max_ps(_mm_set1_ps(b.y1[i]), _mm_loadu_ps(&b.y1[j]));
+    const __m128 xx2 = _mm_min_ps(_mm_set1_ps(b.x2[i]), _mm_loadu_ps(&b.x2[j]));
+    const __m128 yy2 = _mm_min_ps(_mm_set1_ps(b.y2[i]), _mm_loadu_ps(&b.y2[j]));
+
+    const __m128 voffset = _mm_set1_ps(static_cast<float>(offset));
+    const __m128 w = _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_sub_ps(xx2, xx1), voffset));
+    const __m128 h = _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_sub_ps(yy2, yy1), voffset));
+
+    const __m128 inter = _mm_mul_ps(w, h);
+    const __m128 sum = _mm_add_ps(_mm_set1_ps(b.areas[i]), _mm_loadu_ps(&b.areas[j]));
+    const __m128 ovr = _mm_div_ps(inter, _mm_sub_ps(sum, inter));
+    return _mm_movemask_ps(_mm_cmpge_ps(ovr, _mm_set1_ps(iou_threshold)));
+#else
+    int mask = 0;
+    for (uint32_t k = 0; k < 4; k++) {
+        if (calc_iou_soa(b, i, j + k, offset) >= iou_threshold)
+            mask |= 1 << k;
+    }
+    return mask;
+#endif
+}
+
+#ifdef YOLOV5_X86_DISPATCH
+// bit k is set when IoU(box i, box j + k) >= iou_threshold, 8 candidates at a time
+YOLOV5_TARGET_AVX2 inline int calc_iou_mask8(
+        const SortedBoxes &b,
+        const uint32_t i,
+        const uint32_t j,
+        const int64_t offset,
+        const float iou_threshold)
+{
+    const __m256 xx1 = _mm256_max_ps(_mm256_set1_ps(b.x1[i]), _mm256_loadu_ps(&b.x1[j]));
+    const __m256 yy1 = _mm256_max_ps(_mm256_set1_ps(b.y1[i]), _mm256_loadu_ps(&b.y1[j]));
+    const __m256 xx2 = _mm256_min_ps(_mm256_set1_ps(b.x2[i]), _mm256_loadu_ps(&b.x2[j]));
+    const __m256 yy2 = _mm256_min_ps(_mm256_set1_ps(b.y2[i]), _mm256_loadu_ps(&b.y2[j]));
+
+    const __m256 voffset = _mm256_set1_ps(static_cast<float>(offset));
+    const __m256 w = _mm256_max_ps(_mm256_setzero_ps(), _mm256_add_ps(_mm256_sub_ps(xx2, xx1), voffset));
+    const __m256 h = _mm256_max_ps(_mm256_setzero_ps(), _mm256_add_ps(_mm256_sub_ps(yy2, yy1), voffset));
+
+    const __m256 inter = _mm256_mul_ps(w, h);
+    const __m256 sum = _mm256_add_ps(_mm256_set1_ps(b.areas[i]), _mm256_loadu_ps(&b.areas[j]));
+    const __m256 ovr = _mm256_div_ps(inter, _mm256_sub_ps(sum, inter));
+    return _mm256_movemask_ps(_mm256_cmp_ps(ovr, _mm256_set1_ps(iou_threshold), _CMP_GE_OQ));
+}
+
+// 16 candidates at a time
+YOLOV5_TARGET_AVX512 inline int calc_iou_mask16(
+        const SortedBoxes &b,
+        const uint32_t i,
+        const uint32_t j,
+        const int64_t offset,
+        const float iou_threshold)
+{
+    const __m512 xx1 = _mm512_max_ps(_mm512_set1_ps(b.x1[i]), _mm512_loadu_ps(&b.x1[j]));
+    const __m512 yy1 = _mm512_max_ps(_mm512_set1_ps(b.y1[i]), _mm512_loadu_ps(&b.y1[j]));
+    const __m512 xx2 = _mm512_min_ps(_mm512_set1_ps(b.x2[i]), _mm512_loadu_ps(&b.x2[j]));
+    const __m512 yy2 = _mm512_min_ps(_mm512_set1_ps(b.y2[i]), _mm512_loadu_ps(&b.y2[j]));
+
+    const __m512 voffset = _mm512_set1_ps(static_cast<float>(offset));
+    const __m512 w = _mm512_max_ps(_mm512_setzero_ps(), _mm512_add_ps(_mm512_sub_ps(xx2, xx1), voffset));
+    const __m512 h = _mm512_max_ps(_mm512_setzero_ps(), _mm512_add_ps(_mm512_sub_ps(yy2, yy1), voffset));
+
+    const __m512 inter = _mm512_mul_ps(w, h);
+    const __m512 sum = _mm512_add_ps(_mm512_set1_ps(b.areas[i]), _mm512_loadu_ps(&b.areas[j]));
+    const __m512 ovr = _mm512_div_ps(inter, _mm512_sub_ps(sum, inter));
+    return _mm512_cmp_ps_mask(ovr, _mm512_set1_ps(iou_threshold), _CMP_GE_OQ);
+}
+#endif
+
+inline void mark_suppressed(int mask, const uint32_t j, uint8_t *suppressed)
+{
+    while (mask) {
+        int k = __builtin_ctz(mask);
+        suppressed[j + k] = 1;
+        mask &= mask - 1;
+    }
+}
+
+// kept box i suppresses every lower scored box it overlaps, one variant per instruction set
+typedef void (*SuppressFunc)(const SortedBoxes &b, const uint32_t i, const uint32_t num_boxes,
+                             const int64_t offset, const float iou_threshold, uint8_t *suppressed);
+
+static void suppress_overlaps_scalar(const SortedBoxes &b, const uint32_t i, const uint32_t num_boxes,
+                                     const int64_t offset, const float iou_threshold, uint8_t *suppressed)
+{
+    for (uint32_t j = i + 1; j < num_boxes; j++) {
+        if (calc_iou_soa(b, i, j, offset) >= iou_threshold)
+            suppressed[j] = 1;
+    }
+}
+
+static void suppress_overlaps_sse2(const SortedBoxes &b, const uint32_t i, const uint32_t num_boxes,
+                                   const int64_t offset, const float iou_threshold, uint8_t *suppressed)
+{
+    uint32_t j = i + 1;
+    for (; j + 4 <= num_boxes; j += 4) {
+        mark_suppressed(calc_iou_mask4(b, i, j, offset, iou_threshold), j, suppressed);
+    }
+    for (; j < num_boxes; j++) {
+        if (calc_iou_soa(b, i, j, offset) >= iou_threshold)
+            suppressed[j] = 1;
+    }
+}
+
+#ifdef YOLOV5_X86_DISPATCH
+YOLOV5_TARGET_AVX2 static void suppress_overlaps_avx2(const SortedBoxes &b, const uint32_t i, const uint32_t num_boxes,
+                                                      const int64_t offset, const float iou_threshold,
+                                                      uint8_t *suppressed)
+{
+    uint32_t j = i + 1;
+    for (; j + 8 <= num_boxes; j += 8) {
+        mark_suppressed(calc_iou_mask8(b, i, j, offset, iou_threshold), j, suppressed);
+    }
+    for (; j < num_boxes; j++) {
+        if (calc_iou_soa(b, i, j, offset) >= iou_threshold)
+            suppressed[j] = 1;
+    }
+}
+
+YOLOV5_TARGET_AVX512 static void suppress_overlaps_avx512(const SortedBoxes &b, const uint32_t i,
+                                                          const uint32_t num_boxes, const int64_t offset,
+                                                          const float iou_threshold, uint8_t *suppressed)
+{
+    uint32_t j = i + 1;
+    for (; j + 16 <= num_boxes; j += 16) {
+        mark_suppressed(calc_iou_mask16(b, i, j, offset, iou_threshold), j, suppressed);
+    }
+    for (; j < num_boxes; j++) {
+        if (calc_iou_soa(b, i, j, offset) >= iou_threshold)
+            suppressed[j] = 1;
+    }
+}
+#endif
+
+static SuppressFunc select_suppress_overlaps(const CpuIsa isa)
+{
+#ifdef YOLOV5_X86_DISPATCH
+    if (isa >= CPU_ISA_AVX512)
+        return suppress_overlaps_avx512;
+    if (isa >= CPU_ISA_AVX2)
+        return suppress_overlaps_avx2;
+#endif
+    if (isa >= CPU_ISA_SSE2)
+        return suppress_overlaps_sse2;
+    return suppress_overlaps_scalar;
+}
+
+uint64_t mmcv_nms_ndarray_fp32_get_buffer_bytes(const uint32_t num_boxes_in)
+{
+    return SortedBoxes::get_buffer_bytes(num_boxes_in) + num_boxes_in;
+}
+
+ppl::common::RetCode mmcv_nms_ndarray_fp32_soa(
+        const float *boxes,
+        const float *scores,
+        const uint32_t num_boxes_in,
+        const float iou_threshold,
+        const int64_t offset,
+        int64_t *dst,
+        int64_t *num_boxes_out)
+{
+    std::vector<uint8_t> temp_buffer(mmcv_nms_ndarray_fp32_get_buffer_bytes(num_boxes_in));
+    return mmcv_nms_ndarray_fp32_with_buffer(boxes, scores, num_boxes_in, iou_threshold, offset,
+                                             temp_buffer.data(), dst, num_boxes_out);
+}
+
+ppl::common::RetCode mmcv_nms_ndarray_fp32_with_buffer(
+        const float *boxes,
+        const float *scores,
+        const uint32_t num_boxes_in,
+        const float iou_threshold,
+        const int64_t offset,
+        void *temp_buffer,
+        int64_t *dst,
+        int64_t *num_boxes_out)
+{
+    SortedBoxes sorted(boxes, scores, num_boxes_in, offset, temp_buffer);
+    uint8_t *suppressed = static_cast<uint8_t *>(temp_buffer) + SortedBoxes::get_buffer_bytes(num_boxes_in);
+    std::fill(suppressed, suppressed + num_boxes_in, 0);
+
+    const SuppressFunc suppress_overlaps = select_suppress_overlaps(get_cpu_isa());
+
+    *num_boxes_out = 0;
+    for (uint32_t i = 0; i < num_boxes_in; i++) {
+        if (suppressed[i])
+            continue;
+
+        dst[(*num_boxes_out)++] = sorted.index[i];
+        suppress_overlaps(sorted, i, num_boxes_in, offset, iou_threshold, suppressed);
+    }
+
+    return ppl::common::RC_SUCCESS;
+}
+
 ppl::common::RetCode mmcv_nms_ndarray_fp32(
         const float *boxes,
         const float *scores,
@@ -110,6 +389,6 @@ ppl::common::RetCode mmcv_nms_ndarray_fp32(
         int64_t *dst,
         int64_t *num_boxes_out)
 {
-    return mmcv_nms_ndarray_fp32_naive(boxes, scores, num_boxes_in, iou_threshold, offset, dst, num_boxes_out);
+    return mmcv_nms_ndarray_fp32_soa(boxes, scores, num_boxes_in, iou_threshold, offset, dst, num_boxes_out);
 }
 
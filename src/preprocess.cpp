@@ -0,0 +1,322 @@
+#include "preprocess.h"
+#include "cpu_isa.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef YOLOV5_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+// the gray yolov5 pads its letterbox with
+static const float kPadValue = 114.f;
+
+// source coordinate and right/bottom weight of every destination pixel, pixel centers aligned like cv::INTER_LINEAR
+static void compute_bilinear_table(const int src_size, const int dst_size, int* index, float* weight) {
+    const float inv_scale = static_cast<float>(src_size) / dst_size;
+    for (int i = 0; i < dst_size; ++i) {
+        float f = (i + 0.5f) * inv_scale - 0.5f;
+        if (f < 0.f)
+            f = 0.f;
+
+        int i0 = static_cast<int>(f);
+        if (i0 >= src_size - 1) {
+            index[i * 2 + 0] = src_size - 1;
+            index[i * 2 + 1] = src_size - 1;
+            weight[i] = 0.f;
+        } else {
+            index[i * 2 + 0] = i0;
+            index[i * 2 + 1] = i0 + 1;
+            weight[i] = f - i0;
+        }
+    }
+}
+
+// columns [x_begin, x_end) of a resampled row, the planes are those of the whole row
+static inline void resample_columns(const uint8_t* src_row, const int x_begin, const int x_end, const int* x_index,
+                                    const float* x_weight, float* r, float* g, float* b) {
+    for (int x = x_begin; x < x_end; ++x) {
+        const uint8_t* p0 = src_row + x_index[x * 2 + 0] * 3;
+        const uint8_t* p1 = src_row + x_index[x * 2 + 1] * 3;
+        const float w = x_weight[x];
+
+        b[x] = p0[0] + (p1[0] - p0[0]) * w;
+        g[x] = p0[1] + (p1[1] - p0[1]) * w;
+        r[x] = p0[2] + (p1[2] - p0[2]) * w;
+    }
+}
+
+// horizontally resample one packed BGR row into three planar RGB float rows
+static void resample_row_scalar(const uint8_t* src_row, const int src_width, const int width, const int* x_index,
+                                const float* x_weight, float* dst) {
+    resample_columns(src_row, 0, width, x_index, x_weight, dst, dst + width, dst + width * 2);
+}
+
+// dst = (row0 + (row1 - row0) * w) * alpha + beta
+static void blend_rows_scalar(const float* row0, const float* row1, const int width, const float w,
+                              const float alpha, const float beta, float* dst) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = (row0[x] + (row1[x] - row0[x]) * w) * alpha + beta;
+    }
+}
+
+#if defined(__SSE2__)
+static void blend_rows_sse2(const float* row0, const float* row1, const int width, const float w,
+                            const float alpha, const float beta, float* dst) {
+    int x = 0;
+    const __m128 vw = _mm_set1_ps(w);
+    const __m128 valpha = _mm_set1_ps(alpha);
+    const __m128 vbeta = _mm_set1_ps(beta);
+    for (; x + 4 <= width; x += 4) {
+        __m128 v0 = _mm_loadu_ps(row0 + x);
+        __m128 v1 = _mm_loadu_ps(row1 + x);
+        __m128 v = _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), vw));
+        _mm_storeu_ps(dst + x, _mm_add_ps(_mm_mul_ps(v, valpha), vbeta));
+    }
+    blend_rows_scalar(row0 + x, row1 + x, width - x, w, alpha, beta, dst + x);
+}
+#endif
+
+#ifdef YOLOV5_X86_DISPATCH
+// the gathers load 4 bytes per pixel, the columns up to the first one that would read past the
+// pixel right of it are resampled 8 at a time and the rest like the scalar version
+YOLOV5_TARGET_AVX2 static void resample_row_avx2(const uint8_t* src_row, const int src_width, const int width,
+                                                 const int* x_index, const float* x_weight, float* dst) {
+    float* r = dst;
+    float* g = dst + width;
+    float* b = dst + width * 2;
+    const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+    const int* base = reinterpret_cast<const int*>(src_row);
+
+    int x = 0;
+    for (; x + 8 <= width && x_index[(x + 7) * 2 + 1] <= src_width - 2; x += 8) {
+        // (i0, i1) pairs of 8 columns into the i0 and the i1 of each
+        const __m256i pairs0 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(x_index + x * 2)),
+                                                           deinterleave);
+        const __m256i pairs1 = _mm256_permutevar8x32_epi32(
+            _mm256_loadu_si256((const __m256i*)(x_index + x * 2 + 8)), deinterleave);
+        const __m256i i0 = _mm256_permute2x128_si256(pairs0, pairs1, 0x20);
+        const __m256i i1 = _mm256_permute2x128_si256(pairs0, pairs1, 0x31);
+
+        const __m256i bgr0 = _mm256_i32gather_epi32(base, _mm256_mullo_epi32(i0, three), 1);
+        const __m256i bgr1 = _mm256_i32gather_epi32(base, _mm256_mullo_epi32(i1, three), 1);
+        const __m256 w = _mm256_loadu_ps(x_weight + x);
+
+        float* planes[3] = {b, g, r};
+        for (int c = 0; c < 3; ++c) {
+            const __m256i v0 = _mm256_and_si256(_mm256_srli_epi32(bgr0, c * 8), byte_mask);
+            const __m256i v1 = _mm256_and_si256(_mm256_srli_epi32(bgr1, c * 8), byte_mask);
+            const __m256 diff = _mm256_cvtepi32_ps(_mm256_sub_epi32(v1, v0));
+            _mm256_storeu_ps(planes[c] + x, _mm256_add_ps(_mm256_cvtepi32_ps(v0), _mm256_mul_ps(diff, w)));
+        }
+    }
+    resample_columns(src_row, x, width, x_index, x_weight, r, g, b);
+}
+
+YOLOV5_TARGET_AVX512 static void resample_row_avx512(const uint8_t* src_row, const int src_width, const int width,
+                                                     const int* x_index, const float* x_weight, float* dst) {
+    float* r = dst;
+    float* g = dst + width;
+    float* b = dst + width * 2;
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_add_epi32(even, _mm512_set1_epi32(1));
+    const __m512i three = _mm512_set1_epi32(3);
+    const __m512i byte_mask = _mm512_set1_epi32(0xff);
+
+    int x = 0;
+    for (; x + 16 <= width && x_index[(x + 15) * 2 + 1] <= src_width - 2; x += 16) {
+        const __m512i pairs0 = _mm512_loadu_si512(x_index + x * 2);
+        const __m512i pairs1 = _mm512_loadu_si512(x_index + x * 2 + 16);
+        const __m512i i0 = _mm512_permutex2var_epi32(pairs0, even, pairs1);
+        const __m512i i1 = _mm512_permutex2var_epi32(pairs0, odd, pairs1);
+
+        const __m512i bgr0 = _mm512_i32gather_epi32(_mm512_mullo_epi32(i0, three), src_row, 1);
+        const __m512i bgr1 = _mm512_i32gather_epi32(_mm512_mullo_epi32(i1, three), src_row, 1);
+        const __m512 w = _mm512_loadu_ps(x_weight + x);
+
+        float* planes[3] = {b, g, r};
+        for (int c = 0; c < 3; ++c) {
+            const __m512i v0 = _mm512_and_si512(_mm512_srli_epi32(bgr0, c * 8), byte_mask);
+            const __m512i v1 = _mm512_and_si512(_mm512_srli_epi32(bgr1, c * 8), byte_mask);
+            const __m512 diff = _mm512_cvtepi32_ps(_mm512_sub_epi32(v1, v0));
+            _mm512_storeu_ps(planes[c] + x, _mm512_add_ps(_mm512_cvtepi32_ps(v0), _mm512_mul_ps(diff, w)));
+        }
+    }
+    resample_columns(src_row, x, width, x_index, x_weight, r, g, b);
+}
+
+YOLOV5_TARGET_AVX2 static void blend_rows_avx2(const float* row0, const float* row1, const int width, const float w,
+                                               const float alpha, const float beta, float* dst) {
+    int x = 0;
+    const __m256 vw = _mm256_set1_ps(w);
+    const __m256 valpha = _mm256_set1_ps(alpha);
+    const __m256 vbeta = _mm256_set1_ps(beta);
+    for (; x + 8 <= width; x += 8) {
+        __m256 v0 = _mm256_loadu_ps(row0 + x);
+        __m256 v1 = _mm256_loadu_ps(row1 + x);
+        __m256 v = _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), vw));
+        _mm256_storeu_ps(dst + x, _mm256_add_ps(_mm256_mul_ps(v, valpha), vbeta));
+    }
+    blend_rows_scalar(row0 + x, row1 + x, width - x, w, alpha, beta, dst + x);
+}
+
+YOLOV5_TARGET_AVX512 static void blend_rows_avx512(const float* row0, const float* row1, const int width,
+                                                   const float w, const float alpha, const float beta, float* dst) {
+    int x = 0;
+    const __m512 vw = _mm512_set1_ps(w);
+    const __m512 valpha = _mm512_set1_ps(alpha);
+    const __m512 vbeta = _mm512_set1_ps(beta);
+    for (; x + 16 <= width; x += 16) {
+        __m512 v0 = _mm512_loadu_ps(row0 + x);
+        __m512 v1 = _mm512_loadu_ps(row1 + x);
+        __m512 v = _mm512_add_ps(v0, _mm512_mul_ps(_mm512_sub_ps(v1, v0), vw));
+        _mm512_storeu_ps(dst + x, _mm512_add_ps(_mm512_mul_ps(v, valpha), vbeta));
+    }
+    blend_rows_scalar(row0 + x, row1 + x, width - x, w, alpha, beta, dst + x);
+}
+#endif
+
+typedef void (*ResampleRowFunc)(const uint8_t* src_row, const int src_width, const int width, const int* x_index,
+                                const float* x_weight, float* dst);
+typedef void (*BlendRowsFunc)(const float* row0, const float* row1, const int width, const float w,
+                              const float alpha, const float beta, float* dst);
+
+// SSE2 has no gather, its resampling stays scalar
+static ResampleRowFunc select_resample_row(const CpuIsa isa) {
+#ifdef YOLOV5_X86_DISPATCH
+    if (isa >= CPU_ISA_AVX512)
+        return resample_row_avx512;
+    if (isa >= CPU_ISA_AVX2)
+        return resample_row_avx2;
+#endif
+    return resample_row_scalar;
+}
+
+static BlendRowsFunc select_blend_rows(const CpuIsa isa) {
+#ifdef YOLOV5_X86_DISPATCH
+    if (isa >= CPU_ISA_AVX512)
+        return blend_rows_avx512;
+    if (isa >= CPU_ISA_AVX2)
+        return blend_rows_avx2;
+#endif
+#if defined(__SSE2__)
+    if (isa >= CPU_ISA_SSE2)
+        return blend_rows_sse2;
+#endif
+    return blend_rows_scalar;
+}
+
+void letterbox_bgr_to_planar(const uint8_t* src,
+                             const int src_width,
+                             const int src_height,
+                             const size_t src_step,
+                             const int dst_width,
+                             const int dst_height,
+                             const float mean[3],
+                             const float std[3],
+                             float* dst,
+                             LetterboxInfo* info,
+                             void* temp_buffer) {
+    const float scale = std::min(static_cast<float>(dst_width) / src_width,
+                                 static_cast<float>(dst_height) / src_height);
+    const int resized_width  = std::max(1, std::min(dst_width, static_cast<int>(std::round(src_width * scale))));
+    const int resized_height = std::max(1, std::min(dst_height, static_cast<int>(std::round(src_height * scale))));
+    const int pad_left = (dst_width - resized_width) / 2;
+    const int pad_top  = (dst_height - resized_height) / 2;
+
+    info->scale      = scale;
+    info->pad_left   = pad_left;
+    info->pad_top    = pad_top;
+    info->src_width  = src_width;
+    info->src_height = src_height;
+
+    const int plane_size = dst_width * dst_height;
+    float alpha[3], beta[3];
+    for (int c = 0; c < 3; ++c) {
+        alpha[c] = 1.f / std[c];
+        beta[c]  = -mean[c] / std[c];
+    }
+
+    // borders
+    for (int c = 0; c < 3; ++c) {
+        float* plane = dst + c * plane_size;
+        const float pad = kPadValue * alpha[c] + beta[c];
+
+        std::fill(plane, plane + pad_top * dst_width, pad);
+        std::fill(plane + (pad_top + resized_height) * dst_width, plane + plane_size, pad);
+        for (int y = pad_top; y < pad_top + resized_height; ++y) {
+            float* row = plane + y * dst_width;
+            std::fill(row, row + pad_left, pad);
+            std::fill(row + pad_left + resized_width, row + dst_width, pad);
+        }
+    }
+
+    std::vector<uint8_t> local_buffer;
+    if (temp_buffer == NULL) {
+        local_buffer.resize(letterbox_get_buffer_bytes(dst_width, dst_height));
+        temp_buffer = local_buffer.data();
+    }
+
+    // the two source rows around the current output row, resampled horizontally once each
+    const int row_size = resized_width * 3;
+    float* rows     = static_cast<float*>(temp_buffer);
+    float* x_weight = rows + row_size * 2;
+    float* y_weight = x_weight + resized_width;
+    int* x_index    = reinterpret_cast<int*>(y_weight + resized_height);
+    int* y_index    = x_index + resized_width * 2;
+    compute_bilinear_table(src_width, resized_width, x_index, x_weight);
+    compute_bilinear_table(src_height, resized_height, y_index, y_weight);
+    int cached[2] = {-1, -1};
+
+    const CpuIsa isa = get_cpu_isa();
+    const ResampleRowFunc resample_row = select_resample_row(isa);
+    const BlendRowsFunc blend_rows = select_blend_rows(isa);
+
+    for (int y = 0; y < resized_height; ++y) {
+        const int sy0 = y_index[y * 2 + 0];
+        const int sy1 = y_index[y * 2 + 1];
+
+        int slot0 = cached[0] == sy0 ? 0 : (cached[1] == sy0 ? 1 : -1);
+        if (slot0 < 0) {
+            slot0 = cached[0] == sy1 ? 1 : 0;
+            resample_row(src + sy0 * src_step, src_width, resized_width, x_index, x_weight, rows + slot0 * row_size);
+            cached[slot0] = sy0;
+        }
+        int slot1 = cached[0] == sy1 ? 0 : (cached[1] == sy1 ? 1 : -1);
+        if (slot1 < 0) {
+            slot1 = 1 - slot0;
+            resample_row(src + sy1 * src_step, src_width, resized_width, x_index, x_weight, rows + slot1 * row_size);
+            cached[slot1] = sy1;
+        }
+
+        const float* row0 = rows + slot0 * row_size;
+        const float* row1 = rows + slot1 * row_size;
+        for (int c = 0; c < 3; ++c) {
+            float* out = dst + c * plane_size + (pad_top + y) * dst_width + pad_left;
+            blend_rows(row0 + c * resized_width, row1 + c * resized_width, resized_width, y_weight[y],
+                       alpha[c], beta[c], out);
+        }
+    }
+}
+
+uint64_t letterbox_get_buffer_bytes(const int dst_width, const int dst_height) {
+    // rows, weights and indices of a resized image as large as dst
+    return (static_cast<uint64_t>(dst_width) * 6 + dst_width + dst_height) * sizeof(float) +
+           (static_cast<uint64_t>(dst_width) * 2 + dst_height * 2) * sizeof(int);
+}
+
+void scale_coords(const LetterboxInfo& info, float* boxes, const int num_boxes) {
+    const float inv_scale = 1.f / info.scale;
+    for (int i = 0; i < num_boxes; ++i) {
+        float* box = boxes + i * 4;
+        box[0] = std::min(std::max((box[0] - info.pad_left) * inv_scale, 0.f), static_cast<float>(info.src_width));
+        box[1] = std::min(std::max((box[1] - info.pad_top) * inv_scale, 0.f), static_cast<float>(info.src_height));
+        box[2] = std::min(std::max((box[2] - info.pad_left) * inv_scale, 0.f), static_cast<float>(info.src_width));
+        box[3] = std::min(std::max((box[3] - info.pad_top) * inv_scale, 0.f), static_cast<float>(info.src_height));
+    }
+}
@@ -0,0 +1,177 @@
+#include "result_cache.h"
+
+#include <string.h>
+
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+// list node, hash node and bucket of every entry on top of its detections
+static const uint64_t kEntryOverhead = 96;
+
+static inline uint64_t rotl(const uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, const uint64_t input) {
+    acc += input * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+static inline uint64_t merge64(uint64_t acc, const uint64_t value) {
+    acc ^= round64(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+uint64_t ResultCache::hash_bytes(const void* data, const uint64_t size, const uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t h;
+
+    // four independent lanes over 32 byte stripes keep the multipliers busy
+    if (size >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge64(h, v1);
+        h = merge64(h, v2);
+        h = merge64(h, v3);
+        h = merge64(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+
+    h += size;
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        h ^= read32(p) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+ResultCache::ResultCache(const uint64_t capacity_bytes, const int num_shards)
+    : num_shards(num_shards > 0 ? num_shards : 1),
+      hits(0),
+      misses(0),
+      insertions(0),
+      evictions(0) {
+    shard_capacity = capacity_bytes / this->num_shards;
+    shards.reset(new Shard[this->num_shards]);
+}
+
+uint64_t ResultCache::entry_bytes(const Detections& detections) {
+    return kEntryOverhead + sizeof(Entry) + detections.size() * (5 * sizeof(float) + sizeof(int32_t));
+}
+
+bool ResultCache::lookup(const uint64_t key, Detections* detections) {
+    Shard& shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    *detections = it->second->detections;
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ResultCache::insert(const uint64_t key, const Detections& detections) {
+    const uint64_t bytes = entry_bytes(detections);
+    if (bytes > shard_capacity)
+        return;
+
+    Shard& shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // concurrent misses on the same input insert the same result, the later one just refreshes it
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        shard.bytes -= it->second->bytes;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+
+    while (!shard.lru.empty() && shard.bytes + bytes > shard_capacity) {
+        const Entry& victim = shard.lru.back();
+        shard.bytes -= victim.bytes;
+        shard.index.erase(victim.key);
+        shard.lru.pop_back();
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.bytes = bytes;
+    entry.detections = detections;
+    shard.lru.push_front(std::move(entry));
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += bytes;
+    insertions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ResultCache::clear() {
+    for (int i = 0; i < num_shards; ++i) {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        shards[i].lru.clear();
+        shards[i].index.clear();
+        shards[i].bytes = 0;
+    }
+}
+
+ResultCacheCounters ResultCache::get_counters() const {
+    ResultCacheCounters counters;
+    counters.hits       = hits.load(std::memory_order_relaxed);
+    counters.misses     = misses.load(std::memory_order_relaxed);
+    counters.insertions = insertions.load(std::memory_order_relaxed);
+    counters.evictions  = evictions.load(std::memory_order_relaxed);
+    counters.entries    = 0;
+    counters.bytes      = 0;
+    for (int i = 0; i < num_shards; ++i) {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        counters.entries += shards[i].lru.size();
+        counters.bytes += shards[i].bytes;
+    }
+    return counters;
+}
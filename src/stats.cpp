@@ -0,0 +1,104 @@
+#include "stats.h"
+
+static inline int bucket_index(const uint64_t ns) {
+    if (ns < 4)
+        return static_cast<int>(ns);
+
+    // 4 linear sub buckets between two powers of two
+    const int exponent = 63 - __builtin_clzll(ns);
+    const int sub = static_cast<int>((ns >> (exponent - 2)) & 3);
+    return (exponent - 1) * 4 + sub;
+}
+
+static inline uint64_t bucket_upper_bound(const int index) {
+    if (index < 4)
+        return index;
+
+    const int exponent = index / 4 + 1;
+    const uint64_t sub = index % 4;
+    return ((4 + sub + 1) << (exponent - 2)) - 1;
+}
+
+void LatencyHistogram::record(const uint64_t ns) {
+    buckets[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+    total_count.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t current = max_ns.load(std::memory_order_relaxed);
+    while (ns > current && !max_ns.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < kNumBuckets; ++i)
+        buckets[i].store(0, std::memory_order_relaxed);
+    total_count.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean_us() const {
+    const uint64_t n = count();
+    return n ? total_ns.load(std::memory_order_relaxed) / 1000.0 / n : 0.0;
+}
+
+double LatencyHistogram::percentile_us(const double percentile) const {
+    uint64_t counts[kNumBuckets];
+    uint64_t n = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        n += counts[i];
+    }
+    if (n == 0)
+        return 0.0;
+
+    // rank of the requested sample, 1 based
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * n + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucket_upper_bound(i) / 1000.0;
+    }
+    return max_us();
+}
+
+const char* get_stage_name(const DetectStage stage) {
+    static const char* names[STAGE_COUNT] = {
+        "image_decode", "preprocess", "convert_from_host", "run", "convert_to_host",
+        "decode_head0", "decode_head1", "decode_head2", "nms",
+    };
+    return stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+void DetectStats::reset() {
+    for (int i = 0; i < STAGE_COUNT; ++i)
+        stages[i].reset();
+    images.store(0, std::memory_order_relaxed);
+    proposals.store(0, std::memory_order_relaxed);
+    nms_inputs.store(0, std::memory_order_relaxed);
+    detections.store(0, std::memory_order_relaxed);
+}
+
+void DetectStats::print(FILE* fp) const {
+    fprintf(fp, "%-18s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean_us", "p50_us", "p95_us", "p99_us", "max_us");
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        const LatencyHistogram& h = stages[i];
+        if (h.count() == 0)
+            continue;
+
+        fprintf(fp, "%-18s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", get_stage_name(static_cast<DetectStage>(i)),
+                (unsigned long long)h.count(), h.mean_us(), h.percentile_us(50), h.percentile_us(95),
+                h.percentile_us(99), h.max_us());
+    }
+
+    const uint64_t n = images.load(std::memory_order_relaxed);
+    fprintf(fp, "images %llu, proposals/image %.1f, nms inputs/image %.1f, detections/image %.1f\n",
+            (unsigned long long)n,
+            n ? (double)proposals.load(std::memory_order_relaxed) / n : 0.0,
+            n ? (double)nms_inputs.load(std::memory_order_relaxed) / n : 0.0,
+            n ? (double)detections.load(std::memory_order_relaxed) / n : 0.0);
+}
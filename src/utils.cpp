@@ -1,89 +1,532 @@
 #include "utils.h"
+#include "cpu_isa.h"
+#include "detections.h"
+#include "mmcv_nms.h"
+#include "preprocess.h"
 
+#include <algorithm>
 #include <cmath>
 #include <float.h>
 #include <iostream>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef YOLOV5_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
 static inline float sigmoid(float x) {
     return static_cast<float>(1.f / (1.f + exp(-x)));
 }
 
-void generate_proposals(std::vector<float> anchor,
-                        const int num_grid_w,
-                        const int num_grid_h,
-                        const int stride,
-                        const float* output,
-                        float prob_threshold,
-                        const int num_classes,
-                        std::vector<DetectRes>& detect_res) {
+// logit(p), so that sigmoid(x) >= p <=> x >= inverse_sigmoid(p)
+static inline float inverse_sigmoid(float p) {
+    if (p <= 0.f)
+        return -FLT_MAX;
+    if (p >= 1.f)
+        return FLT_MAX;
+
+    return static_cast<float>(log(p / (1.f - p)));
+}
+
+// index of the first maximum, the same one a scalar `>` scan would return
+static int argmax_scalar(const float* x, const int n, float* max_value) {
+    int index = 0;
+    float m = -FLT_MAX;
+    for (int k = 0; k < n; ++k) {
+        if (x[k] > m) {
+            index = k;
+            m = x[k];
+        }
+    }
+    *max_value = m;
+    return index;
+}
+
+#if defined(__SSE2__)
+static int argmax_sse2(const float* x, const int n, float* max_value) {
+    if (n < 8)
+        return argmax_scalar(x, n, max_value);
+
+    int k;
+    __m128 vmax0 = _mm_loadu_ps(x);
+    __m128 vmax1 = _mm_loadu_ps(x + 4);
+    for (k = 8; k + 8 <= n; k += 8) {
+        vmax0 = _mm_max_ps(vmax0, _mm_loadu_ps(x + k));
+        vmax1 = _mm_max_ps(vmax1, _mm_loadu_ps(x + k + 4));
+    }
+    __m128 vmax = _mm_max_ps(vmax0, vmax1);
+    vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+    vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+    float m = _mm_cvtss_f32(vmax);
+    for (; k < n; ++k) {
+        if (x[k] > m)
+            m = x[k];
+    }
+
+    const __m128 vm = _mm_set1_ps(m);
+    *max_value = m;
+    for (k = 0; k + 4 <= n; k += 4) {
+        int mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(x + k), vm));
+        if (mask)
+            return k + __builtin_ctz(mask);
+    }
+    for (; k < n; ++k) {
+        if (x[k] == m)
+            break;
+    }
+    return k;
+}
+#endif
+
+#ifdef YOLOV5_X86_DISPATCH
+YOLOV5_TARGET_AVX2 static int argmax_avx2(const float* x, const int n, float* max_value) {
+    if (n < 16)
+        return argmax_scalar(x, n, max_value);
+
+    int k;
+    __m256 vmax0 = _mm256_loadu_ps(x);
+    __m256 vmax1 = _mm256_loadu_ps(x + 8);
+    for (k = 16; k + 16 <= n; k += 16) {
+        vmax0 = _mm256_max_ps(vmax0, _mm256_loadu_ps(x + k));
+        vmax1 = _mm256_max_ps(vmax1, _mm256_loadu_ps(x + k + 8));
+    }
+    vmax0 = _mm256_max_ps(vmax0, vmax1);
+    __m128 vmax = _mm_max_ps(_mm256_castps256_ps128(vmax0), _mm256_extractf128_ps(vmax0, 1));
+    vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+    vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+    float m = _mm_cvtss_f32(vmax);
+    for (; k < n; ++k) {
+        if (x[k] > m)
+            m = x[k];
+    }
+
+    const __m256 vm = _mm256_set1_ps(m);
+    *max_value = m;
+    for (k = 0; k + 8 <= n; k += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + k), vm, _CMP_EQ_OQ));
+        if (mask)
+            return k + __builtin_ctz(mask);
+    }
+    for (; k < n; ++k) {
+        if (x[k] == m)
+            break;
+    }
+    return k;
+}
+
+YOLOV5_TARGET_AVX512 static int argmax_avx512(const float* x, const int n, float* max_value) {
+    if (n < 16)
+        return argmax_avx2(x, n, max_value);
+
+    // one accumulator, 80 classes are exactly 5 steps
+    int k;
+    __m512 vmax = _mm512_loadu_ps(x);
+    for (k = 16; k + 16 <= n; k += 16) {
+        vmax = _mm512_max_ps(vmax, _mm512_loadu_ps(x + k));
+    }
+    float m = _mm512_reduce_max_ps(vmax);
+    for (; k < n; ++k) {
+        if (x[k] > m)
+            m = x[k];
+    }
+
+    const __m512 vm = _mm512_set1_ps(m);
+    *max_value = m;
+    for (k = 0; k + 16 <= n; k += 16) {
+        int mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + k), vm, _CMP_EQ_OQ);
+        if (mask)
+            return k + __builtin_ctz(mask);
+    }
+    for (; k < n; ++k) {
+        if (x[k] == m)
+            break;
+    }
+    return k;
+}
+#endif
+
+typedef int (*ArgmaxFunc)(const float* x, const int n, float* max_value);
+
+static ArgmaxFunc select_argmax(const CpuIsa isa) {
+#ifdef YOLOV5_X86_DISPATCH
+    if (isa >= CPU_ISA_AVX512)
+        return argmax_avx512;
+    if (isa >= CPU_ISA_AVX2)
+        return argmax_avx2;
+#endif
+#if defined(__SSE2__)
+    if (isa >= CPU_ISA_SSE2)
+        return argmax_sse2;
+#endif
+    return argmax_scalar;
+}
+
+int generate_proposals_rows(const float anchor_w,
+                            const float anchor_h,
+                            const int num_grid_w,
+                            const int row_begin,
+                            const int row_end,
+                            const int stride,
+                            const float* output,
+                            float prob_threshold,
+                            const int num_classes,
+                            float* boxes,
+                            float* scores,
+                            int* labels) {
+
+    const int offset = num_classes + 5;
+
+    // confidence = sigmoid(box_score) * sigmoid(class_score) <= min of both sigmoids,
+    // so both logits have to reach logit(prob_threshold) before the cell is worth decoding
+    const float logit_threshold = inverse_sigmoid(prob_threshold);
+    const ArgmaxFunc argmax = select_argmax(get_cpu_isa());
+
+    int num_proposals = 0;
+    for (int i = row_begin; i < row_end; i++) {
+        for (int j = 0; j < num_grid_w; j++) {
+            const float* cell = output + (i * num_grid_w + j) * offset;
+
+            float box_score = cell[4];
+            if (box_score < logit_threshold)
+                continue;
+
+            // find class index with max class score
+            float class_score;
+            int class_index = argmax(cell + 5, num_classes, &class_score);
+            if (class_score < logit_threshold)
+                continue;
+
+            float confidence = sigmoid(box_score) * sigmoid(class_score);
+            if (confidence < prob_threshold)
+                continue;
+
+            float dx = sigmoid(cell[0]);
+            float dy = sigmoid(cell[1]);
+            float dw = sigmoid(cell[2]) * 2.f;
+            float dh = sigmoid(cell[3]) * 2.f;
+
+            float pb_cx = (dx * 2.f - 0.5f + j) * stride;
+            float pb_cy = (dy * 2.f - 0.5f + i) * stride;
+
+            float pb_w = dw * dw * anchor_w;
+            float pb_h = dh * dh * anchor_h;
+
+            float* box = boxes + num_proposals * 4;
+            box[0] = pb_cx - pb_w * 0.5f;
+            box[1] = pb_cy - pb_h * 0.5f;
+            box[2] = pb_cx + pb_w * 0.5f;
+            box[3] = pb_cy + pb_h * 0.5f;
+
+            scores[num_proposals] = confidence;
+            labels[num_proposals] = class_index;
+            ++num_proposals;
+        }
+    }
+
+    return num_proposals;
+}
+
+int generate_proposals(const std::vector<float>& anchor,
+                       const int num_grid_w,
+                       const int num_grid_h,
+                       const int stride,
+                       const float* output,
+                       float prob_threshold,
+                       const int num_classes,
+                       float* boxes,
+                       float* scores,
+                       int* labels) {
 
     const int num_anchor = anchor.size() / 2;
     const int offset = num_classes + 5;
     const int area_grid = num_grid_w * num_grid_h;
 
+    int num_proposals = 0;
+    for (int q = 0; q < num_anchor; q++) {
+        num_proposals += generate_proposals_rows(anchor[q * 2], anchor[q * 2 + 1], num_grid_w, 0, num_grid_h, stride,
+                                                 output + q * area_grid * offset, prob_threshold, num_classes,
+                                                 boxes + num_proposals * 4, scores + num_proposals,
+                                                 labels + num_proposals);
+    }
 
-    for (int q = 0; q  < num_anchor; q++) {
-        const float anchor_w = anchor[q * 2];
-        const float anchor_h = anchor[q * 2 + 1];
-
-        for (int i = 0; i < num_grid_h; i++) {
-            for (int j = 0; j < num_grid_w; j++){
-                // find class index with max class score
-                // std::cout << "i: " << i << std::endl;
-                int class_index = 0;
-                float class_score = -FLT_MAX;
-                int offset_xy = i * num_grid_h * offset + j * offset;
-
-                for (int k = 0; k < num_classes; ++k) {
-                    float score = output[q * area_grid * offset + offset_xy + 5 + k];
-                    // std::cout << "score: " << score << std::endl;
-                    if (score > class_score) {
-                        class_index = k;
-                        class_score = score;
-                    }
-                }
-
-                // std::cout << "class_score: " << class_score << std::endl;
-
-                float box_score = output[q * area_grid * offset + offset_xy + 4];
-                // std::cout << "box_score: " << box_score << std::endl;
-                float confidence = sigmoid(box_score) * sigmoid(class_score);
-                // std::cout << "confidence: " << confidence << std::endl;
-                // std::cout << "--------------------------" << std::endl;
-
-                if (confidence >= prob_threshold) {
-                    float dx = sigmoid(output[q * area_grid * offset + offset_xy + 0]);
-                    float dy = sigmoid(output[q * area_grid * offset + offset_xy + 1]);
-                    float dw = sigmoid(output[q * area_grid * offset + offset_xy + 2]);
-                    float dh = sigmoid(output[q * area_grid * offset + offset_xy + 3]);
-
-                    //std::cout << "dx: " << dx << " dy: " << dy << " dw: " << dw << " dh: " << dh << std::endl;
-    
-                    float pb_cx = (dx * 2.f - 0.5f + j) * stride;
-                    float pb_cy = (dy * 2.f - 0.5f + i) * stride;
-
-                    float pb_w = pow(dw * 2.f, 2) * anchor_w;
-                    float pb_h = pow(dh * 2.f, 2) * anchor_h;
-
-                    //printf("pb_cx: %f pb_cy: %f pb_w: %f pb_h: %f\n", pb_cx, pb_cy, pb_w, pb_h);
-
-                    float x0 = pb_cx - pb_w * 0.5f;
-                    float y0 = pb_cy - pb_h * 0.5f;
-                    float x1 = pb_cx + pb_w * 0.5f;
-                    float y1 = pb_cy + pb_h * 0.5f;
-
-                    DetectRes proposal;
-                    proposal.x_min = x0;
-                    proposal.y_min = y0;
-                    proposal.x_max = x1;
-                    proposal.y_max = y1;
-                    proposal.label = class_index;
-                    proposal.prob  = confidence;
-
-                    detect_res.push_back(proposal);
-                }
-
-            }
-        }
+    return num_proposals;
+}
+
+static inline int decode_fused_row(const float* row,
+                                   const int num_classes,
+                                   const float prob_threshold,
+                                   const ArgmaxFunc argmax,
+                                   float* box,
+                                   float* score,
+                                   int* label) {
+    float class_score;
+    const int class_index = argmax(row + 5, num_classes, &class_score);
+    const float confidence = row[4] * class_score;
+    if (confidence < prob_threshold)
+        return 0;
+
+    box[0] = row[0] - row[2] * 0.5f;
+    box[1] = row[1] - row[3] * 0.5f;
+    box[2] = row[0] + row[2] * 0.5f;
+    box[3] = row[1] + row[3] * 0.5f;
+    *score = confidence;
+    *label = class_index;
+    return 1;
+}
+
+// decode the rows of a block whose bit is set in mask
+static inline int decode_fused_block(const float* rows,
+                                     int mask,
+                                     const int num_classes,
+                                     const float prob_threshold,
+                                     const ArgmaxFunc argmax,
+                                     float* boxes,
+                                     float* scores,
+                                     int* labels) {
+    const int offset = num_classes + 5;
+    int num_proposals = 0;
+    while (mask) {
+        const int k = __builtin_ctz(mask);
+        mask &= mask - 1;
+        num_proposals += decode_fused_row(rows + k * offset, num_classes, prob_threshold, argmax,
+                                          boxes + num_proposals * 4, scores + num_proposals, labels + num_proposals);
+    }
+    return num_proposals;
+}
+
+// almost every row fails on objectness, so a whole block of them is rejected with one compare.
+// The functions below take num_rows as a multiple of their block.
+#if defined(__SSE2__)
+static int decode_fused_sse2(const float* output, const int num_rows, const int num_classes,
+                             const float prob_threshold, const ArgmaxFunc argmax,
+                             float* boxes, float* scores, int* labels) {
+    const int offset = num_classes + 5;
+    const __m128 vthreshold = _mm_set1_ps(prob_threshold);
+    int num_proposals = 0;
+    for (int i = 0; i < num_rows; i += 4) {
+        const float* rows = output + i * offset;
+        const __m128 obj = _mm_set_ps(rows[3 * offset + 4], rows[2 * offset + 4], rows[offset + 4], rows[4]);
+        const int mask = _mm_movemask_ps(_mm_cmpge_ps(obj, vthreshold));
+        if (mask)
+            num_proposals += decode_fused_block(rows, mask, num_classes, prob_threshold, argmax,
+                                                boxes + num_proposals * 4, scores + num_proposals,
+                                                labels + num_proposals);
+    }
+    return num_proposals;
+}
+#endif
+
+#ifdef YOLOV5_X86_DISPATCH
+YOLOV5_TARGET_AVX2 static int decode_fused_avx2(const float* output, const int num_rows, const int num_classes,
+                                                const float prob_threshold, const ArgmaxFunc argmax,
+                                                float* boxes, float* scores, int* labels) {
+    const int offset = num_classes + 5;
+    const __m256 vthreshold = _mm256_set1_ps(prob_threshold);
+    const __m256i vindex = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                                               _mm256_set1_epi32(offset)),
+                                            _mm256_set1_epi32(4));
+    int num_proposals = 0;
+    for (int i = 0; i < num_rows; i += 8) {
+        const float* rows = output + i * offset;
+        const __m256 obj = _mm256_i32gather_ps(rows, vindex, 4);
+        const int mask = _mm256_movemask_ps(_mm256_cmp_ps(obj, vthreshold, _CMP_GE_OQ));
+        if (mask)
+            num_proposals += decode_fused_block(rows, mask, num_classes, prob_threshold, argmax,
+                                                boxes + num_proposals * 4, scores + num_proposals,
+                                                labels + num_proposals);
+    }
+    return num_proposals;
+}
+
+YOLOV5_TARGET_AVX512 static int decode_fused_avx512(const float* output, const int num_rows, const int num_classes,
+                                                    const float prob_threshold, const ArgmaxFunc argmax,
+                                                    float* boxes, float* scores, int* labels) {
+    const int offset = num_classes + 5;
+    const __m512 vthreshold = _mm512_set1_ps(prob_threshold);
+    const __m512i vindex = _mm512_add_epi32(
+        _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+                           _mm512_set1_epi32(offset)),
+        _mm512_set1_epi32(4));
+    int num_proposals = 0;
+    for (int i = 0; i < num_rows; i += 16) {
+        const float* rows = output + i * offset;
+        const __m512 obj = _mm512_i32gather_ps(vindex, rows, 4);
+        const int mask = _mm512_cmp_ps_mask(obj, vthreshold, _CMP_GE_OQ);
+        if (mask)
+            num_proposals += decode_fused_block(rows, mask, num_classes, prob_threshold, argmax,
+                                                boxes + num_proposals * 4, scores + num_proposals,
+                                                labels + num_proposals);
+    }
+    return num_proposals;
+}
+#endif
+
+int decode_fused_output(const float* output,
+                        const int num_boxes,
+                        const int num_classes,
+                        const float prob_threshold,
+                        float* boxes,
+                        float* scores,
+                        int* labels) {
+    const int offset = num_classes + 5;
+    const CpuIsa isa = get_cpu_isa();
+    const ArgmaxFunc argmax = select_argmax(isa);
+    int num_proposals = 0;
+    int i = 0;
+
+#ifdef YOLOV5_X86_DISPATCH
+    if (isa >= CPU_ISA_AVX512) {
+        i = num_boxes & ~15;
+        num_proposals = decode_fused_avx512(output, i, num_classes, prob_threshold, argmax, boxes, scores, labels);
+    } else if (isa >= CPU_ISA_AVX2) {
+        i = num_boxes & ~7;
+        num_proposals = decode_fused_avx2(output, i, num_classes, prob_threshold, argmax, boxes, scores, labels);
+    }
+#endif
+#if defined(__SSE2__)
+    if (isa >= CPU_ISA_SSE2) {
+        const int num_rows = (num_boxes - i) & ~3;
+        num_proposals += decode_fused_sse2(output + i * offset, num_rows, num_classes, prob_threshold, argmax,
+                                           boxes + num_proposals * 4, scores + num_proposals, labels + num_proposals);
+        i += num_rows;
+    }
+#endif
+
+    for (; i < num_boxes; ++i) {
+        const float* row = output + i * offset;
+        if (row[4] < prob_threshold)
+            continue;
+        num_proposals += decode_fused_row(row, num_classes, prob_threshold, argmax, boxes + num_proposals * 4,
+                                          scores + num_proposals, labels + num_proposals);
+    }
+
+    return num_proposals;
+}
+
+int select_topk_proposals(float* boxes,
+                          float* scores,
+                          int* labels,
+                          const int num_proposals,
+                          const int k,
+                          int* temp_buffer) {
+    if (k <= 0 || num_proposals <= k)
+        return num_proposals;
+
+    int* index = temp_buffer;
+    std::iota(index, index + num_proposals, 0);
+    std::nth_element(index, index + k, index + num_proposals, [scores](const int a, const int b) {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    });
+    std::sort(index, index + k);
+
+    // index[i] >= i after sorting, so compacting front to back never overwrites a survivor
+    for (int i = 0; i < k; ++i) {
+        const int src = index[i];
+        if (src == i)
+            continue;
+
+        std::copy(boxes + src * 4, boxes + src * 4 + 4, boxes + i * 4);
+        scores[i] = scores[src];
+        labels[i] = labels[src];
+    }
+
+    return k;
+}
+
+void offset_boxes_by_label(const float* boxes,
+                           const int* labels,
+                           const int num_boxes,
+                           float* dst) {
+    float max_coordinate = 0.f;
+    for (int i = 0; i < num_boxes * 4; ++i) {
+        max_coordinate = std::max(max_coordinate, std::fabs(boxes[i]));
+    }
+
+    // boxes may reach past the image on both sides, so classes are 2 * max |coordinate| apart
+    const float class_offset = 2.f * max_coordinate + 1.f;
+    for (int i = 0; i < num_boxes; ++i) {
+        const float offset = labels[i] * class_offset;
+        dst[i * 4 + 0] = boxes[i * 4 + 0] + offset;
+        dst[i * 4 + 1] = boxes[i * 4 + 1] + offset;
+        dst[i * 4 + 2] = boxes[i * 4 + 2] + offset;
+        dst[i * 4 + 3] = boxes[i * 4 + 3] + offset;
+    }
+}
+
+int suppress_proposals(float* boxes,
+                       float* scores,
+                       int* labels,
+                       const int num_proposals,
+                       const int pre_nms_topk,
+                       const float nms_threshold,
+                       const bool class_agnostic,
+                       const int max_det,
+                       ScratchArena* arena,
+                       int64_t* keep) {
+    // bound the nms input on busy frames
+    const int num_boxes = select_topk_proposals(boxes, scores, labels, num_proposals, pre_nms_topk,
+                                                arena->alloc<int>(num_proposals));
+
+    // per class suppression in one pass, boxes of different labels are moved apart
+    const float* nms_boxes = boxes;
+    if (!class_agnostic) {
+        float* offset_boxes = arena->alloc<float>(num_boxes * 4);
+        offset_boxes_by_label(boxes, labels, num_boxes, offset_boxes);
+        nms_boxes = offset_boxes;
+    }
+
+    int64_t num_keep = 0;
+    mmcv_nms_ndarray_fp32_with_buffer(nms_boxes, scores, num_boxes, nms_threshold, 0,
+                                      arena->alloc<uint8_t>(mmcv_nms_ndarray_fp32_get_buffer_bytes(num_boxes)),
+                                      keep, &num_keep);
+
+    // kept boxes come in descending score order
+    if (max_det > 0 && num_keep > max_det)
+        num_keep = max_det;
+
+    return static_cast<int>(num_keep);
+}
+
+int select_detections(float* boxes,
+                      float* scores,
+                      int* labels,
+                      const int num_proposals,
+                      const int pre_nms_topk,
+                      const float nms_threshold,
+                      const bool class_agnostic,
+                      const int max_det,
+                      const LetterboxInfo& letterbox,
+                      ScratchArena* arena,
+                      Detections* detections) {
+    int64_t* keep = arena->alloc<int64_t>(num_proposals);
+    const int num_keep = suppress_proposals(boxes, scores, labels, num_proposals, pre_nms_topk, nms_threshold,
+                                            class_agnostic, max_det, arena, keep);
+
+    detections->clear();
+    for (int i = 0; i < num_keep; ++i) {
+        float* box = boxes + keep[i] * 4;
+        scale_coords(letterbox, box, 1);
+        detections->push_back(box, scores[keep[i]], labels[keep[i]]);
+    }
+    return num_keep;
+}
+
+void compute_tile_offsets(const int length,
+                          const int tile,
+                          const int overlap,
+                          std::vector<int>* offsets) {
+    offsets->clear();
+    if (length <= tile || tile <= 0) {
+        offsets->push_back(0);
+        return;
     }
-}
\ No newline at end of file
+
+    const int step = std::max(tile - std::max(overlap, 0), 1);
+    const int num_tiles = (length - tile + step - 1) / step + 1;
+    for (int i = 0; i < num_tiles; ++i) {
+        offsets->push_back(std::min(i * step, length - tile));
+    }
+}
@@ -1,59 +1,394 @@
 #include "yolov5.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
+#include "affinity.h"
+#include "cpu_isa.h"
+#include "image_decode.h"
+#include "log.h"
 #include "mmcv_nms.h"
 
 using namespace ppl::common;
 using namespace ppl::nn;
 
-Yolov5Impl::Yolov5Impl(const ModelParams model_params){
-    this->model_params.yolov5_height  = model_params.yolov5_height;
-    this->model_params.yolov5_width   = model_params.yolov5_width;
-    this->model_params.yolov5_channel = model_params.yolov5_channel;
+// dynamic input shapes are rounded up to the stride of the coarsest head
+static const int kShapeAlignment = 32;
+
+// cells of the smallest parallel decode slice, below that the fork and the merge cost more than the decode
+static const int kMinDecodeSliceCells = 1024;
+
+/**
+* \brief Rows of one anchor plane, or of the fused output, decoded by one thread into proposal slots of its own
+*/
+struct DecodeSlice{
+    const float* output;     ///< row 0 of the anchor plane or of the fused output
+    const float* anchor;     ///< (w, h) of the anchor, NULL for the fused output
+    int num_grid_w;          ///< cells per row, 1 for the fused output
+    int row_begin;
+    int row_end;
+    int stride;
+    int first_slot;          ///< the slice writes to [first_slot, first_slot + its cells) of the proposal buffers
+    int num_proposals;       ///< written by the thread which decoded the slice
+};
+
+/**
+* \brief Checks a runtime out of the pool for the lifetime of the lease
+*/
+class Yolov5Impl::RuntimeLease{
+    public:
+        RuntimeLease(Yolov5Impl* impl, const int batch, const int height, const int width)
+            : impl(impl), context(impl->acquire_runtime(batch, height, width)) {}
+        ~RuntimeLease() { if (context) impl->release_runtime(context); }
 
-    this->model_params.num_classes    = model_params.num_classes;
-    this->model_params.onnx_path      = model_params.onnx_path;
-    this->model_params.prob_threshold = model_params.prob_threshold;
-    this->model_params.nms_threshold  = model_params.nms_threshold;
+        RuntimeContext* get() const { return context; }
 
-    memcpy(this->model_params.mean, model_params.mean, 3*sizeof(float));
-    memcpy(this->model_params.std, model_params.std, 3*sizeof(float));
+    private:
+        Yolov5Impl* impl;
+        RuntimeContext* context;
+};
+
+Yolov5Impl::Yolov5Impl(const ModelParams model_params)
+    : busy_runtimes(0), pending_runtimes(0), acquire_clock(0) {
+    this->model_params = model_params;
+    this->model_params.anchors = NULL; // copied below, the caller's array may go away
+    if (this->model_params.num_runtimes <= 0)
+        this->model_params.num_runtimes = 1;
+
+    // the yolov5 P5 anchors, unless the model was trained with anchors of its own
+    static const float kDefaultAnchors[18] = {10.f, 13.f, 16.f, 30.f, 33.f, 23.f,
+                                              30.f, 61.f, 62.f, 45.f, 59.f, 119.f,
+                                              116.f, 90.f, 156.f, 198.f, 373.f, 326.f};
+    const float* anchor_values = model_params.anchors ? model_params.anchors : kDefaultAnchors;
+    for (int i = 0; i < 3; ++i)
+        anchors[i].assign(anchor_values + i * 6, anchor_values + (i + 1) * 6);
+
+    // cached results are only valid for the settings they were computed with
+    const float thresholds[2] = {model_params.prob_threshold, model_params.nms_threshold};
+    const int32_t settings[7] = {model_params.num_classes, model_params.yolov5_height, model_params.yolov5_width,
+                                 model_params.pre_nms_topk, model_params.max_det, model_params.class_agnostic,
+                                 model_params.dynamic_shape};
+    cache_seed = ResultCache::hash_bytes(thresholds, sizeof(thresholds), 0);
+    cache_seed = ResultCache::hash_bytes(settings, sizeof(settings), cache_seed);
+    cache_seed = ResultCache::hash_bytes(model_params.mean, sizeof(model_params.mean), cache_seed);
+    cache_seed = ResultCache::hash_bytes(model_params.std, sizeof(model_params.std), cache_seed);
+    cache_seed = ResultCache::hash_bytes(anchor_values, 18 * sizeof(float), cache_seed);
+    if (model_params.result_cache_bytes > 0)
+        result_cache.reset(new ResultCache(model_params.result_cache_bytes));
 }
 
 RetCode Yolov5Impl::yolov5_network_detect_init(){
-    
-    if (access( model_params.onnx_path, F_OK ) == -1){
-        fprintf(stderr, "Not found %s \n", model_params.onnx_path);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<int> cpus;
+    if (resolve_cpus(&cpus) != RC_SUCCESS)
         return RC_INVALID_VALUE;
+
+    // every runtime gets its own num_threads cores when the set is large enough, otherwise they share it
+    split_cpus(cpus, model_params.num_runtimes, model_params.num_threads, &runtime_cpus);
+
+    // create runtime builder onnx model
+    X86EngineOptions engine_options;
+    engine_options.mm_policy = model_params.mm_policy;
+    x86_engine.reset(X86EngineFactory::Create(engine_options));
+
+    RetCode status = create_builder();
+    if (status != RC_SUCCESS)
+        return status;
+
+    YOLOV5_LOG("successfully create runtime builder!\n");
+
+    // every runtime shares the constants held by the builder, only activations are per runtime
+    for (int i = 0; i < model_params.num_runtimes; ++i) {
+        std::unique_ptr<RuntimeContext> context;
+        status = create_runtime(runtime_cpus[i], 1, model_params.yolov5_height, model_params.yolov5_width, &context);
+        if (status != RC_SUCCESS)
+            return status;
+
+        idle_runtimes.push_back(context.get());
+        runtime_pool.push_back(std::move(context));
+    }
+
+    YOLOV5_LOG("successfully build %d runtime(s)!\n", model_params.num_runtimes);
+    YOLOV5_LOG("decode, nms and preprocess kernels: %s\n", get_cpu_isa_name(get_cpu_isa()));
+
+    status = warm_up();
+    if (status != RC_SUCCESS)
+        return status;
+
+    YOLOV5_LOG("init done in %.1f ms\n",
+               std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    return RC_SUCCESS;
+}
+
+RetCode Yolov5Impl::create_builder(){
+    Engine* engines[] = {x86_engine.get()};
+
+    if (model_params.model_buffer) {
+        builder.reset(OnnxRuntimeBuilderFactory::Create(model_params.model_buffer, model_params.model_buffer_size,
+                                                        engines, 1));
+        if (!builder){
+            fprintf(stderr, "create RuntimeBuilder from onnx model buffer failed!\n");
+            return RC_INVALID_VALUE;
+        }
+        return RC_SUCCESS;
     }
 
-    in_data = (float*)malloc(model_params.yolov5_height * model_params.yolov5_width * model_params.yolov5_channel*sizeof(float));
-    if (in_data == NULL)
+    int fd = open(model_params.onnx_path, O_RDONLY);
+    if (fd < 0){
+        fprintf(stderr, "Not found %s \n", model_params.onnx_path);
         return RC_INVALID_VALUE;
+    }
 
-    // create runtime builder onnx model
-    Engine* x86_engine = X86EngineFactory::Create(X86EngineOptions());
-    RuntimeBuilder* builder = OnnxRuntimeBuilderFactory::Create(model_params.onnx_path, &x86_engine, 1);
+    // parse straight from the page cache instead of copying the file into a buffer first
+    struct stat file_stat;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        mapped = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (mapped != MAP_FAILED) {
+        madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+        builder.reset(OnnxRuntimeBuilderFactory::Create(static_cast<const char*>(mapped), file_stat.st_size,
+                                                        engines, 1));
+        munmap(mapped, file_stat.st_size);
+    } else {
+        builder.reset(OnnxRuntimeBuilderFactory::Create(model_params.onnx_path, engines, 1));
+    }
 
     if (!builder){
         fprintf(stderr, "create RuntimeBuilder from onnx model %s failed!\n", model_params.onnx_path);
         return RC_INVALID_VALUE;
     }
 
-    printf("successfully create runtime builder!\n");
+    return RC_SUCCESS;
+}
 
-    context.reset(builder->CreateRuntime());
-    if (!context) {
+RetCode Yolov5Impl::create_runtime(const std::vector<int>& cpus, const int batch, const int height, const int width,
+                                   std::unique_ptr<RuntimeContext>* context){
+    std::unique_ptr<RuntimeContext> created(new RuntimeContext());
+    {
+        std::lock_guard<std::mutex> lock(builder_mutex);
+        created->runtime.reset(builder->CreateRuntime());
+    }
+    if (!created->runtime) {
         fprintf(stderr, "build runtime failed!\n");
         return RC_INVALID_VALUE;
     }
-    
-    printf("successfully build runtime!\n");
 
-    input_tensor = std::shared_ptr<Tensor>(context->GetInputTensor(0));
-    const std::vector<int64_t> input_shape{1, model_params.yolov5_channel, model_params.yolov5_height, model_params.yolov5_width};
+#ifdef PPLNN_ENABLE_KERNEL_PROFILING
+    if (model_params.enable_profiling) {
+        created->runtime->Configure(RUNTIME_CONF_SET_KERNEL_PROFILING_FLAG, true);
+    }
+#endif
+
+    created->cpus = cpus;
+    created->input_tensor = created->runtime->GetInputTensor(0);
+    RetCode status = reshape_input(created.get(), batch, height, width);
+    if (status != RC_SUCCESS)
+        return status;
+    created->scratch.reserve(scratch_bytes_for(model_params.yolov5_height, model_params.yolov5_width));
+
+    *context = std::move(created);
+    return RC_SUCCESS;
+}
+
+RetCode Yolov5Impl::warm_up(){
+    if (model_params.num_warmup <= 0)
+        return RC_SUCCESS;
+
+    // a gray frame at the largest input runs every kernel selection and allocation of the full path
+    cv::Mat frame(model_params.yolov5_height, model_params.yolov5_width, CV_8UC3, cv::Scalar(114, 114, 114));
+    std::vector<DetectRes> detect_res;
+
+    for (auto& context : runtime_pool) {
+        for (int i = 0; i < model_params.num_warmup; ++i) {
+            RetCode status = reshape_input(context.get(), 1, model_params.yolov5_height, model_params.yolov5_width);
+            if (status == RC_SUCCESS)
+                status = preprocess(frame, context.get(), 0);
+            if (status == RC_SUCCESS)
+                status = run_network(context.get());
+            if (status == RC_SUCCESS)
+                status = postprecess(context.get(), 0, detect_res);
+            if (status != RC_SUCCESS) {
+                fprintf(stderr, "warm up failed: %s\n", GetRetCodeStr(status));
+                return status;
+            }
+            detect_res.clear();
+        }
+    }
+
+    // the statistics describe served frames only
+    stats.reset();
+    return RC_SUCCESS;
+}
+
+uint64_t Yolov5Impl::scratch_bytes_for(const int height, const int width) const{
+    // one proposal per anchor and cell of the stride 8, 16 and 32 heads, as many as rows of a fused output
+    const uint64_t num_proposals = 3 * ((height / 8) * (width / 8) + (height / 16) * (width / 16) +
+                                        (height / 32) * (width / 32));
+    const uint64_t align = ScratchArena::kAlignment;
+
+    // boxes, scores, labels, keep, top k indices, offset boxes and the nms buffer, each rounded up
+    uint64_t postprocess_bytes = num_proposals * (4 * sizeof(float) + sizeof(float) + sizeof(int) +
+                                                        sizeof(int64_t) + sizeof(int) + 4 * sizeof(float)) +
+                                       mmcv_nms_ndarray_fp32_get_buffer_bytes(num_proposals) + 7 * align;
+    // non final slices of a plane hold at least half of kMinDecodeSliceCells, and there are at most 9 planes
+    const uint64_t decode_bytes = (num_proposals / (kMinDecodeSliceCells / 2) + 9) * sizeof(DecodeSlice) + align;
+    postprocess_bytes += model_params.decode_threads > 1 ? decode_bytes : 0;
+    const uint64_t preprocess_bytes = letterbox_get_buffer_bytes(width, height) + align;
+    return std::max(postprocess_bytes, preprocess_bytes);
+}
+
+RetCode Yolov5Impl::resolve_cpus(std::vector<int>* cpus) const{
+    cpus->clear();
+    if (model_params.cpu_list) {
+        if (!parse_cpu_list(model_params.cpu_list, cpus)) {
+            fprintf(stderr, "invalid cpu list %s\n", model_params.cpu_list);
+            return RC_INVALID_VALUE;
+        }
+    } else if (model_params.numa_node >= 0) {
+        if (!read_numa_node_cpus(model_params.numa_node, cpus)) {
+            fprintf(stderr, "cannot read the cores of numa node %d\n", model_params.numa_node);
+            return RC_INVALID_VALUE;
+        }
+    }
+
+    return RC_SUCCESS;
+}
+
+RetCode Yolov5Impl::get_kernel_profile(ProfilingStatistics* profile){
+#ifdef PPLNN_ENABLE_KERNEL_PROFILING
+    if (!model_params.enable_profiling || profile == NULL)
+        return RC_UNSUPPORTED;
+
+    // holding the pool lock with every runtime idle keeps them from running while being read
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    pool_cond.wait(lock, [this] { return busy_runtimes == 0; });
+
+    profile->prof_info.clear();
+    for (auto& context : runtime_pool) {
+        ProfilingStatistics runtime_profile;
+        RetCode status = context->runtime->GetProfilingStatistics(&runtime_profile);
+        if (status != RC_SUCCESS)
+            return status;
+
+        // kernels are reported in the same order by every runtime of one builder
+        if (profile->prof_info.empty()) {
+            profile->prof_info = runtime_profile.prof_info;
+            continue;
+        }
+        for (size_t i = 0; i < profile->prof_info.size() && i < runtime_profile.prof_info.size(); ++i) {
+            profile->prof_info[i].exec_microseconds += runtime_profile.prof_info[i].exec_microseconds;
+            profile->prof_info[i].exec_count += runtime_profile.prof_info[i].exec_count;
+        }
+    }
+
+    return RC_SUCCESS;
+#else
+    (void)profile;
+    return RC_UNSUPPORTED;
+#endif
+}
+
+RuntimeContext* Yolov5Impl::acquire_runtime(const int batch, const int height, const int width){
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (runtime_pool.empty())
+        return NULL;
+
+    // with busy_runtimes < num_runtimes at least one runtime is idle, however many were added
+    pool_cond.wait(lock, [this] { return busy_runtimes < model_params.num_runtimes; });
+    ++busy_runtimes;
+
+    // runtimes keep the shape they ran last, prefer one that needs no reshape
+    for (size_t i = 0; i < idle_runtimes.size(); ++i) {
+        RuntimeContext* context = idle_runtimes[i];
+        if (context->batch_size == batch && context->input_height == height && context->input_width == width) {
+            idle_runtimes.erase(idle_runtimes.begin() + i);
+            context->last_used = ++acquire_clock;
+            return context;
+        }
+    }
+
+    // a shape none of them has, a new runtime keeps it for the next frames of that shape
+    const size_t max_runtimes = model_params.num_runtimes + std::max(model_params.shape_cache_runtimes, 0);
+    if (runtime_pool.size() + pending_runtimes < max_runtimes) {
+        const std::vector<int>& cpus = runtime_cpus[(runtime_pool.size() + pending_runtimes) % runtime_cpus.size()];
+        ++pending_runtimes;
+        lock.unlock();
+
+        std::unique_ptr<RuntimeContext> created;
+        RetCode status = create_runtime(cpus, batch, height, width, &created);
+
+        lock.lock();
+        --pending_runtimes;
+        if (status == RC_SUCCESS) {
+            RuntimeContext* context = created.get();
+            context->last_used = ++acquire_clock;
+            runtime_pool.push_back(std::move(created));
+            YOLOV5_LOG("runtime %zu created for %dx%dx%d\n", runtime_pool.size(), batch, height, width);
+            return context;
+        }
+    }
+
+    // otherwise the least recently used idle runtime is reshaped
+    size_t index = 0;
+    for (size_t i = 1; i < idle_runtimes.size(); ++i) {
+        if (idle_runtimes[i]->last_used < idle_runtimes[index]->last_used)
+            index = i;
+    }
+
+    RuntimeContext* context = idle_runtimes[index];
+    idle_runtimes.erase(idle_runtimes.begin() + index);
+    context->last_used = ++acquire_clock;
+    return context;
+}
+
+void Yolov5Impl::release_runtime(RuntimeContext* context){
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        idle_runtimes.push_back(context);
+        --busy_runtimes;
+    }
+    // acquirers and get_kernel_profile wait on different conditions
+    pool_cond.notify_all();
+}
+
+void Yolov5Impl::input_shape_for(const cv::Mat& src, int* height, int* width) const{
+    *height = model_params.yolov5_height;
+    *width  = model_params.yolov5_width;
+    if (!model_params.dynamic_shape || src.empty())
+        return;
+
+    // the letterboxed image rounded up to the alignment, e.g. 640x384 instead of 640x640 for 16:9
+    const float scale = std::min(static_cast<float>(model_params.yolov5_width) / src.cols,
+                                 static_cast<float>(model_params.yolov5_height) / src.rows);
+    const int resized_height = static_cast<int>(std::round(src.rows * scale));
+    const int resized_width  = static_cast<int>(std::round(src.cols * scale));
+    *height = std::min(model_params.yolov5_height, (resized_height + kShapeAlignment - 1) / kShapeAlignment * kShapeAlignment);
+    *width  = std::min(model_params.yolov5_width, (resized_width + kShapeAlignment - 1) / kShapeAlignment * kShapeAlignment);
+}
+
+RetCode Yolov5Impl::reshape_input(RuntimeContext* context, const int batch, const int height, const int width){
+    if (batch <= 0 || height <= 0 || width <= 0)
+        return RC_INVALID_VALUE;
+
+    if (batch == context->batch_size && height == context->input_height && width == context->input_width)
+        return RC_SUCCESS;
+
+    Tensor* input_tensor = context->input_tensor;
+    const std::vector<int64_t> input_shape{batch, model_params.yolov5_channel, height, width};
     input_tensor->GetShape().Reshape(input_shape);
     auto status = input_tensor->ReallocBuffer();
     if (status != RC_SUCCESS){
@@ -62,230 +397,659 @@ RetCode Yolov5Impl::yolov5_network_detect_init(){
         return RC_INVALID_VALUE;
     }
 
+    // preprocess writes straight into the tensor unless the engine picked another type or layout
+    const TensorShape& shape = input_tensor->GetShape();
+    context->input_zero_copy = (shape.GetDataType() == DATATYPE_FLOAT32 && shape.GetDataFormat() == DATAFORMAT_NDARRAY);
+    if (context->input_zero_copy) {
+        context->input_data = (float*)input_tensor->GetBufferPtr();
+    } else {
+        // description of the prepared data, not the input tensor's description
+        context->input_desc = shape;
+        context->input_desc.SetDataType(DATATYPE_FLOAT32);
+        context->input_desc.SetDataFormat(DATAFORMAT_NDARRAY); // for 4-D Tensor, NDARRAY == NCHW
+
+        const uint64_t image_size = height * width * model_params.yolov5_channel;
+        if (batch * image_size > context->in_data_size) {
+            float* data = (float*)realloc(context->in_data, batch * image_size * sizeof(float));
+            if (data == NULL)
+                return RC_OUT_OF_MEMORY;
+
+            context->in_data = data;
+            context->in_data_size = batch * image_size;
+        }
+        context->input_data = context->in_data;
+    }
+
+    context->batch_size   = batch;
+    context->input_height = height;
+    context->input_width  = width;
+    context->letterbox.resize(batch);
+    return RC_SUCCESS;
+}
+
+RetCode Yolov5Impl::preprocess(cv::Mat& src, RuntimeContext* context, const int batch_index){
+    if (src.empty() || src.type() != CV_8UC3 || context == NULL || batch_index < 0 || batch_index >= context->batch_size)
+        return RC_INVALID_VALUE;
+
+    ScopedTimer timer(stats.stages[STAGE_PREPROCESS]);
+
+    // every image is written into its own slice of one contiguous NCHW buffer
+    const int height = context->input_height;
+    const int width = context->input_width;
+    float* in_data = context->input_data + (uint64_t)batch_index * height * width * model_params.yolov5_channel;
+
+    // letterbox, BGR to RGB, HWC to CHW and y = (x - mean) / std in a single pass over src
+    context->scratch.reset();
+    letterbox_bgr_to_planar(src.ptr<uint8_t>(), src.cols, src.rows, src.step[0],
+                            width, height,
+                            model_params.mean, model_params.std, in_data, &context->letterbox[batch_index],
+                            context->scratch.alloc<uint8_t>(letterbox_get_buffer_bytes(width, height)));
+
     return RC_SUCCESS;
 }
 
-RetCode Yolov5Impl::preprocess(cv::Mat& src, float* in_data){
-    if (src.empty() || in_data == NULL)
+template <typename Result>
+RetCode Yolov5Impl::detect_single(cv::Mat& src, Result& result) {
+    if (src.empty())
+        return RC_INVALID_VALUE;
+
+    int height, width;
+    input_shape_for(src, &height, &width);
+
+    RuntimeLease lease(this, 1, height, width);
+    RuntimeContext* context = lease.get();
+    if (context == NULL)
         return RC_INVALID_VALUE;
 
+    RetCode retcode = reshape_input(context, 1, height, width);
+    if (retcode != RC_SUCCESS)
+        return retcode;
+
+    retcode = preprocess(src, context, 0);
+    if (retcode != RC_SUCCESS)
+        return retcode;
+
+    retcode = run_network(context);
+    if (retcode != RC_SUCCESS)
+        return retcode;
+
+    return postprecess(context, 0, result);
+}
+
+// cached detections are handed out like detect_single does, DetectRes appended and Detections overwritten
+static void emit_detections(const Detections& cached, std::vector<DetectRes>& detect_res) {
+    cached.append_to(detect_res);
+}
+
+static void emit_detections(const Detections& cached, Detections& detections) {
+    detections = cached;
+}
+
+uint64_t Yolov5Impl::image_key(const cv::Mat& src) const {
+    const int32_t header[3] = {src.rows, src.cols, src.type()};
+    uint64_t key = ResultCache::hash_bytes(header, sizeof(header), cache_seed);
 
-    // split 3 channel to change HWC to CHW
-    std::vector<cv::Mat> rgb_channels(3);
-    cv::split(src, rgb_channels);
+    const uint64_t row_bytes = (uint64_t)src.cols * src.elemSize();
+    if (src.isContinuous())
+        return ResultCache::hash_bytes(src.ptr(0), row_bytes * src.rows, key);
+    for (int y = 0; y < src.rows; ++y)
+        key = ResultCache::hash_bytes(src.ptr(y), row_bytes, key);
+    return key;
+}
 
-    // by this constructor, when cv::Mat r_channel_fp32 changed, in_data will also change
-    cv::Mat r_channel_fp32(640, 640, CV_32FC1, in_data + 0 * 640 * 640);
-    cv::Mat g_channel_fp32(640, 640, CV_32FC1, in_data + 1 * 640 * 640);
-    cv::Mat b_channel_fp32(640, 640, CV_32FC1, in_data + 2 * 640 * 640);
-    std::vector<cv::Mat> rgb_channels_fp32{r_channel_fp32, g_channel_fp32, b_channel_fp32};
+template <typename Result>
+RetCode Yolov5Impl::detect_cached(cv::Mat& src, Result& result) {
+    if (!result_cache || src.empty())
+        return detect_single(src, result);
 
-    // convert uint8 to fp32, y = (x - mean) / std
-    // const float mean[3] = {0, 0, 0}; // change mean & std according to your dataset & training param
-    std::cout << model_params.std[0] << std::endl; 
-    for (uint32_t i = 0; i < rgb_channels.size(); ++i) {
-        rgb_channels[i].convertTo(rgb_channels_fp32[i], CV_32FC1, 1.0f / model_params.std[i], -model_params.mean[i] / model_params.std[i]);
+    // a duplicate costs one pass of the hash over its pixels instead of the whole detect path
+    thread_local Detections detections;
+    const uint64_t key = image_key(src);
+    if (!result_cache->lookup(key, &detections)) {
+        RetCode retcode = detect_single(src, detections);
+        if (retcode != RC_SUCCESS)
+            return retcode;
+        result_cache->insert(key, detections);
     }
 
+    emit_detections(detections, result);
     return RC_SUCCESS;
 }
 
 RetCode Yolov5Impl::yolov5_network_detect(cv::Mat& src, std::vector<DetectRes>& detect_res) {
-    if (src.empty() || context == NULL)
+    return detect_cached(src, detect_res);
+}
+
+RetCode Yolov5Impl::yolov5_network_detect(cv::Mat& src, Detections& detections) {
+    return detect_cached(src, detections);
+}
+
+ResultCacheCounters Yolov5Impl::get_cache_counters() const {
+    if (result_cache)
+        return result_cache->get_counters();
+
+    ResultCacheCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    return counters;
+}
+
+template <typename Result>
+RetCode Yolov5Impl::detect_batch(std::vector<cv::Mat>& srcs, std::vector<Result>& results) {
+    if (srcs.empty())
         return RC_INVALID_VALUE;
 
-    const int width   = model_params.yolov5_width;
-    const int height  = model_params.yolov5_width;
-    const int channel = model_params.yolov5_channel;
+    // the batch shares one shape, the smallest that holds every image
+    const int batch = srcs.size();
+    int height = 0, width = 0;
+    for (int n = 0; n < batch; ++n) {
+        int image_height, image_width;
+        input_shape_for(srcs[n], &image_height, &image_width);
+        height = std::max(height, image_height);
+        width  = std::max(width, image_width);
+    }
 
-    // float* in_data = (float*)malloc(width*height*channel*sizeof(float));
-    if (in_data == NULL)
+    RuntimeLease lease(this, batch, height, width);
+    RuntimeContext* context = lease.get();
+    if (context == NULL)
         return RC_INVALID_VALUE;
-    
-    RetCode retcode = preprocess(src, in_data);
 
-    // set model input data
-    // set input data descriptor
-    TensorShape src_desc = input_tensor->GetShape(); // description of your prepared data, not input tensor's description
-    src_desc.SetDataType(DATATYPE_FLOAT32);
-    src_desc.SetDataFormat(DATAFORMAT_NDARRAY); // for 4-D Tensor, NDARRAY == NCHW
+    RetCode retcode = reshape_input(context, batch, height, width);
+    if (retcode != RC_SUCCESS)
+        return retcode;
 
+    for (int n = 0; n < batch; ++n) {
+        retcode = preprocess(srcs[n], context, n);
+        if (retcode != RC_SUCCESS)
+            return retcode;
+    }
 
-    retcode = input_tensor->ConvertFromHost(in_data, src_desc); // convert data type & format from src_desc to input_tensor & fill data
-    if (retcode != RC_SUCCESS) {
-        fprintf(stderr, "set input data to tensor [%s] failed: %s\n", input_tensor->GetName(), GetRetCodeStr(retcode));
-        return RC_INVALID_VALUE;
+    retcode = run_network(context);
+    if (retcode != RC_SUCCESS)
+        return retcode;
+
+    results.resize(batch);
+    for (int n = 0; n < batch; ++n) {
+        retcode = postprecess(context, n, results[n]);
+        if (retcode != RC_SUCCESS)
+            return retcode;
     }
 
-    printf("successfully set input data to tensor [%s]!\n", input_tensor->GetName());
+    return RC_SUCCESS;
+}
 
-    // forward
-    retcode = context->Run(); // forward
-    if (retcode != RC_SUCCESS) {
-        fprintf(stderr, "run network failed: %s\n", GetRetCodeStr(retcode));
-        return RC_INVALID_VALUE;
+RetCode Yolov5Impl::yolov5_network_detect_encoded(const uint8_t* data, const uint64_t size, Detections& detections) {
+    // keyed on the encoded bytes, so a duplicate is not even decoded; the seed keeps them apart from pixel keys
+    uint64_t key = 0;
+    if (result_cache && data && size > 0) {
+        key = ResultCache::hash_bytes(data, size, cache_seed + 1);
+        if (result_cache->lookup(key, &detections))
+            return RC_SUCCESS;
     }
 
-    retcode = context->Sync(); // wait for all ops run finished, not implemented yet.
-    if (retcode != RC_SUCCESS) { // now sync is done by runtime->Run() function.
-        fprintf(stderr, "runtime sync failed: %s\n", GetRetCodeStr(retcode));
-        return RC_INVALID_VALUE;
+    cv::Mat image;
+    float scale_x, scale_y;
+    {
+        ScopedTimer timer(stats.stages[STAGE_IMAGE_DECODE]);
+        RetCode retcode = decode_image(data, size, model_params.yolov5_width, model_params.yolov5_height, &image,
+                                       &scale_x, &scale_y);
+        if (retcode != RC_SUCCESS)
+            return retcode;
     }
 
-    printf("successfully run network!\n");
+    RetCode retcode = detect_single(image, detections);
+    if (retcode != RC_SUCCESS)
+        return retcode;
+
+    // from the reduced decode back to the full size image
+    for (size_t i = 0; i < detections.size(); ++i) {
+        detections.x1[i] *= scale_x;
+        detections.y1[i] *= scale_y;
+        detections.x2[i] *= scale_x;
+        detections.y2[i] *= scale_y;
+    }
 
-    postprecess(detect_res);
+    if (result_cache)
+        result_cache->insert(key, detections);
+    return RC_SUCCESS;
 }
 
-RetCode Yolov5Impl::postprecess(std::vector<DetectRes>& detect_res){
-    if (context == NULL)
-        return RC_INVALID_VALUE; 
+RetCode Yolov5Impl::yolov5_network_detect_encoded(const uint8_t* data, const uint64_t size,
+                                                  std::vector<DetectRes>& detect_res) {
+    Detections detections;
+    RetCode retcode = yolov5_network_detect_encoded(data, size, detections);
+    if (retcode != RC_SUCCESS)
+        return retcode;
 
-    std::vector<DetectRes> proposals;
+    detections.append_to(detect_res);
+    return RC_SUCCESS;
+}
 
-    // stride 8
-    {
-        auto output_tensor = context->GetOutputTensor(0);
-        uint64_t output_size = output_tensor->GetShape().GetElementsExcludingPadding();
-        std::vector<float> output_data_(output_size);
-        float* output_data = output_data_.data();
+RetCode Yolov5Impl::yolov5_network_detect_batch(std::vector<cv::Mat>& srcs, std::vector<std::vector<DetectRes>>& detect_res) {
+    return detect_batch(srcs, detect_res);
+}
 
-        // set output data descriptor
-        TensorShape dst_desc = output_tensor->GetShape(); // description of your output data buffer, not output_tensor's description
-        dst_desc.SetDataType(DATATYPE_FLOAT32);
-        dst_desc.SetDataFormat(DATAFORMAT_NDARRAY); // output is 1-D Tensor, NDARRAY == vector
+RetCode Yolov5Impl::yolov5_network_detect_batch(std::vector<cv::Mat>& srcs, std::vector<Detections>& detections) {
+    return detect_batch(srcs, detections);
+}
 
-        auto status = output_tensor->ConvertToHost(output_data, dst_desc); // convert data type & format from output_tensor to dst_desc
-        if (status != RC_SUCCESS) {
-            fprintf(stderr, "get output data from tensor [%s] failed: %s\n", output_tensor->GetName(),
-                    GetRetCodeStr(status));
-            return -1;
-        }
+RetCode Yolov5Impl::yolov5_network_detect_tiled(cv::Mat& src, const TileParams& tile_params,
+                                                std::vector<DetectRes>& detect_res) {
+    if (src.empty())
+        return RC_INVALID_VALUE;
 
-        printf("successfully get outputs!\n");
+    const int tile_width  = tile_params.tile_width > 0 ? tile_params.tile_width : model_params.yolov5_width;
+    const int tile_height = tile_params.tile_height > 0 ? tile_params.tile_height : model_params.yolov5_height;
+    const int tiles_per_batch = std::max(tile_params.tiles_per_batch, 1);
 
-        std::cout << output_size << std::endl;
-        
-        std::vector<float> anchor = {10.f, 13.f, 16.f, 30.f, 33.f, 23.f};
-        std::vector<DetectRes> proposals8;
-        generate_proposals(anchor, 80, 80, 8, (float*)(output_tensor->GetBufferPtr()), 
-                          model_params.prob_threshold, model_params.num_classes, proposals8);
+    std::vector<int> x_offsets, y_offsets;
+    compute_tile_offsets(src.cols, tile_width, tile_params.overlap, &x_offsets);
+    compute_tile_offsets(src.rows, tile_height, tile_params.overlap, &y_offsets);
 
-        proposals.insert(proposals.end(), proposals8.begin(), proposals8.end());
+    // tiles are views into src, the full frame goes last in a batch of its own as its shape differs
+    std::vector<cv::Mat> tiles;
+    std::vector<cv::Point> origins;
+    for (int y : y_offsets) {
+        for (int x : x_offsets) {
+            cv::Rect roi(x, y, std::min(tile_width, src.cols - x), std::min(tile_height, src.rows - y));
+            tiles.push_back(src(roi));
+            origins.push_back(roi.tl());
+        }
     }
+    const int num_tiles = tiles.size();
+    const int num_tile_batches = (num_tiles + tiles_per_batch - 1) / tiles_per_batch;
+    const int num_batches = num_tile_batches + (tile_params.full_frame_pass ? 1 : 0);
 
-    // stride 16
-    {
-        auto output_tensor = context->GetOutputTensor(1);
-        uint64_t output_size = output_tensor->GetShape().GetElementsExcludingPadding();
-        std::vector<float> output_data_(output_size);
-        float* output_data = output_data_.data();
+    std::vector<Detections> tile_res(num_tiles + 1);
+    std::vector<RetCode> batch_status(num_batches, RC_SUCCESS);
+    std::atomic<int> next_batch(0);
 
-        // set output data descriptor
-        TensorShape dst_desc = output_tensor->GetShape(); // description of your output data buffer, not output_tensor's description
-        dst_desc.SetDataType(DATATYPE_FLOAT32);
-        dst_desc.SetDataFormat(DATAFORMAT_NDARRAY); // output is 1-D Tensor, NDARRAY == vector
+    auto detect_batches = [&]() {
+        for (int b = next_batch.fetch_add(1); b < num_batches; b = next_batch.fetch_add(1)) {
+            if (b == num_tile_batches) {
+                batch_status[b] = yolov5_network_detect(src, tile_res[num_tiles]);
+                continue;
+            }
 
-        auto status = output_tensor->ConvertToHost(output_data, dst_desc); // convert data type & format from output_tensor to dst_desc
-        if (status != RC_SUCCESS) {
-            fprintf(stderr, "get output data from tensor [%s] failed: %s\n", output_tensor->GetName(),
-                    GetRetCodeStr(status));
-            return -1;
+            const int first = b * tiles_per_batch;
+            const int last = std::min(first + tiles_per_batch, num_tiles);
+            if (last - first == 1) {
+                batch_status[b] = yolov5_network_detect(tiles[first], tile_res[first]);
+                continue;
+            }
+
+            std::vector<cv::Mat> batch(tiles.begin() + first, tiles.begin() + last);
+            std::vector<Detections> batch_res;
+            batch_status[b] = yolov5_network_detect_batch(batch, batch_res);
+            for (size_t i = 0; i < batch_res.size(); ++i)
+                std::swap(tile_res[first + i], batch_res[i]);
         }
+    };
 
-        printf("successfully get outputs!\n");
+    // the calling thread takes part, every helper holds at most one runtime at a time
+    std::vector<std::thread> helpers;
+    const int num_helpers = std::min(model_params.num_runtimes, num_batches) - 1;
+    for (int i = 0; i < num_helpers; ++i)
+        helpers.push_back(std::thread(detect_batches));
+    detect_batches();
+    for (auto& helper : helpers)
+        helper.join();
+
+    for (RetCode status : batch_status) {
+        if (status != RC_SUCCESS)
+            return status;
+    }
+
+    // every detection in src coordinates
+    std::vector<float> boxes;
+    std::vector<float> scores;
+    std::vector<int> labels;
+    for (int t = 0; t <= num_tiles; ++t) {
+        const cv::Point origin = t < num_tiles ? origins[t] : cv::Point(0, 0);
+        const Detections& res = tile_res[t];
+        for (size_t i = 0; i < res.size(); ++i) {
+            boxes.push_back(res.x1[i] + origin.x);
+            boxes.push_back(res.y1[i] + origin.y);
+            boxes.push_back(res.x2[i] + origin.x);
+            boxes.push_back(res.y2[i] + origin.y);
+            scores.push_back(res.score[i]);
+            labels.push_back(res.label[i]);
+        }
+    }
+    const int num_boxes = scores.size();
 
-        std::cout << output_size << std::endl;
-        
-        std::vector<float> anchor = {30.f, 61.f, 62.f, 45.f, 59.f, 119.f};
-        std::vector<DetectRes> proposals16;
-        generate_proposals(anchor, 40, 40, 16, (float*)(output_tensor->GetBufferPtr()), 
-                          model_params.prob_threshold, model_params.num_classes, proposals16);
+    // duplicates of one object from neighbouring tiles and the full frame pass
+    const float merge_iou_threshold = tile_params.merge_iou_threshold > 0.f ? tile_params.merge_iou_threshold
+                                                                            : model_params.nms_threshold;
+    ScratchArena scratch;
+    std::vector<int64_t> keep_index(num_boxes);
+    const int num_keep_box = suppress_proposals(boxes.data(), scores.data(), labels.data(), num_boxes, 0,
+                                                merge_iou_threshold, model_params.class_agnostic,
+                                                model_params.max_det, &scratch, keep_index.data());
 
-        proposals.insert(proposals.end(), proposals16.begin(), proposals16.end());
+    for (int i = 0; i < num_keep_box; ++i) {
+        const int64_t index = keep_index[i];
+        DetectRes res;
+        res.x_min = boxes[index * 4 + 0];
+        res.y_min = boxes[index * 4 + 1];
+        res.x_max = boxes[index * 4 + 2];
+        res.y_max = boxes[index * 4 + 3];
+        res.label = labels[index];
+        res.prob  = scores[index];
+        detect_res.push_back(res);
     }
 
-     // stride 32
+    return RC_SUCCESS;
+}
+
+RetCode Yolov5Impl::run_network(RuntimeContext* context) {
+    Tensor* input_tensor = context->input_tensor;
+
+    // the kernels run on the calling thread and its OpenMP team, bound once to the runtime's cores and
+    // re-pinned only when the thread moves on to a runtime on other cores
+    if (!ensure_current_thread_bound(context->cpus, model_params.num_threads))
+        return RC_OTHER_ERROR;
+
+    if (!context->input_zero_copy) {
+        ScopedTimer timer(stats.stages[STAGE_CONVERT_FROM_HOST]);
+
+        // set model input data
+        // set input data descriptor
+        RetCode retcode = input_tensor->ConvertFromHost(context->in_data, context->input_desc); // convert data type & format from src_desc to input_tensor & fill data
+        if (retcode != RC_SUCCESS) {
+            fprintf(stderr, "set input data to tensor [%s] failed: %s\n", input_tensor->GetName(), GetRetCodeStr(retcode));
+            return RC_INVALID_VALUE;
+        }
+    }
+
+    YOLOV5_LOG("successfully set input data to tensor [%s]!\n", input_tensor->GetName());
+
     {
-        auto output_tensor = context->GetOutputTensor(2);
-        uint64_t output_size = output_tensor->GetShape().GetElementsExcludingPadding();
-        std::vector<float> output_data_(output_size);
-        float* output_data = output_data_.data();
+        ScopedTimer timer(stats.stages[STAGE_RUN]);
+
+        // forward
+        RetCode retcode = context->runtime->Run(); // forward
+        if (retcode != RC_SUCCESS) {
+            fprintf(stderr, "run network failed: %s\n", GetRetCodeStr(retcode));
+            return RC_INVALID_VALUE;
+        }
+
+        retcode = context->runtime->Sync(); // wait for all ops run finished, not implemented yet.
+        if (retcode != RC_SUCCESS) { // now sync is done by runtime->Run() function.
+            fprintf(stderr, "runtime sync failed: %s\n", GetRetCodeStr(retcode));
+            return RC_INVALID_VALUE;
+        }
+    }
 
-        // set output data descriptor
-        TensorShape dst_desc = output_tensor->GetShape(); // description of your output data buffer, not output_tensor's description
+    YOLOV5_LOG("successfully run network!\n");
+
+    // read outputs in place, convert only the ones the engine left in another type or layout
+    ScopedTimer timer(stats.stages[STAGE_CONVERT_TO_HOST]);
+    const uint32_t output_count = context->runtime->GetOutputCount();
+    context->outputs.resize(output_count);
+    context->output_host.resize(output_count);
+    context->output_desc.resize(output_count);
+    for (uint32_t i = 0; i < output_count; ++i) {
+        auto output_tensor = context->runtime->GetOutputTensor(i);
+        const TensorShape& shape = output_tensor->GetShape();
+        if (shape.GetDataType() == DATATYPE_FLOAT32 && shape.GetDataFormat() == DATAFORMAT_NDARRAY) {
+            context->outputs[i] = (const float*)output_tensor->GetBufferPtr();
+            continue;
+        }
+
+        std::vector<float>& output_data = context->output_host[i];
+        output_data.resize(shape.GetElementsExcludingPadding());
+
+        // set output data descriptor, assigned into the cached one so its dims keep their storage
+        TensorShape& dst_desc = context->output_desc[i]; // description of your output data buffer, not output_tensor's description
+        dst_desc = shape;
         dst_desc.SetDataType(DATATYPE_FLOAT32);
-        dst_desc.SetDataFormat(DATAFORMAT_NDARRAY); // output is 1-D Tensor, NDARRAY == vector
+        dst_desc.SetDataFormat(DATAFORMAT_NDARRAY);
 
-        auto status = output_tensor->ConvertToHost(output_data, dst_desc); // convert data type & format from output_tensor to dst_desc
+        auto status = output_tensor->ConvertToHost(output_data.data(), dst_desc); // convert data type & format from output_tensor to dst_desc
         if (status != RC_SUCCESS) {
             fprintf(stderr, "get output data from tensor [%s] failed: %s\n", output_tensor->GetName(),
                     GetRetCodeStr(status));
-            return -1;
+            return RC_INVALID_VALUE;
         }
+        context->outputs[i] = output_data.data();
+    }
 
-        printf("successfully get outputs!\n");
-        std::cout << output_size << std::endl;
-        
-        std::vector<float> anchor = {116.f, 90.f, 156.f, 198.f, 373.f, 326.f};
-        std::vector<DetectRes> proposals32;
-        generate_proposals(anchor, 20, 20, 32, (float*)(output_tensor->GetBufferPtr()), 
-                          model_params.prob_threshold, model_params.num_classes, proposals32);
+    return RC_SUCCESS;
+}
 
-        proposals.insert(proposals.end(), proposals32.begin(), proposals32.end());
-    }
+RetCode Yolov5Impl::postprecess(RuntimeContext* context, const int batch_index, std::vector<DetectRes>& detect_res){
+    RetCode retcode = postprecess(context, batch_index, context->detections);
+    if (retcode != RC_SUCCESS)
+        return retcode;
 
-    //nms
-    {
-        float* bbox_vec = (float*)malloc(proposals.size()*4*sizeof(float));
-        float* scores_vec = (float*)malloc(proposals.size()*sizeof(float));
+    context->detections.append_to(detect_res);
+    return RC_SUCCESS;
+}
 
-        for (size_t i = 0; i < proposals.size(); ++i) {
-            bbox_vec[i*4 + 0] = proposals[i].x_min;
-            bbox_vec[i*4 + 1] = proposals[i].y_min;
-            bbox_vec[i*4 + 2] = proposals[i].x_max;
-            bbox_vec[i*4 + 3] = proposals[i].y_max;
+RetCode Yolov5Impl::resolve_output_layout(RuntimeContext* context) const{
+    const int row_size = model_params.num_classes + 5;
+    std::vector<std::pair<int, int>> heads; // grid height and output index of every raw head
 
-            scores_vec[i] = proposals[i].prob;
+    // a model exported with the Detect layer may keep the raw heads as extra outputs, the decoded one wins
+    const uint32_t output_count = context->runtime->GetOutputCount();
+    for (uint32_t i = 0; i < output_count; ++i) {
+        const TensorShape& shape = context->runtime->GetOutputTensor(i)->GetShape();
+        if (shape.GetDimCount() == 3 && shape.GetDim(2) == row_size) {
+            context->output_layout = OUTPUT_LAYOUT_FUSED;
+            context->head_outputs[0] = i;
+            YOLOV5_LOG("output %u is the decoded [N, %d, %d] output\n", i, (int)shape.GetDim(1), row_size);
+            return RC_SUCCESS;
         }
+        if (shape.GetDimCount() == 5 && shape.GetDim(1) == 3 && shape.GetDim(4) == row_size)
+            heads.push_back(std::make_pair((int)shape.GetDim(2), (int)i));
+    }
+
+    if (heads.size() != 3) {
+        fprintf(stderr, "unsupported outputs: expected one [N, boxes, %d] or three [N, 3, h, w, %d] tensors\n",
+                row_size, row_size);
+        return RC_UNSUPPORTED;
+    }
 
-        int64_t* keep_index = (int64_t*)malloc(proposals.size()*sizeof(int16_t));
-        int64_t num_keep_box = 0;
-        mmcv_nms_ndarray_fp32(bbox_vec, scores_vec, proposals.size(), 
-                            model_params.nms_threshold, 4, 
-                            keep_index, &num_keep_box);
+    // the finest grid is the stride 8 head, whatever order the exporter put them in
+    std::sort(heads.begin(), heads.end(), std::greater<std::pair<int, int>>());
+    for (int i = 0; i < 3; ++i)
+        context->head_outputs[i] = heads[i].second;
+    context->output_layout = OUTPUT_LAYOUT_RAW_HEADS;
+    YOLOV5_LOG("outputs %d, %d and %d are the raw heads\n", heads[0].second, heads[1].second, heads[2].second);
+    return RC_SUCCESS;
+}
 
-        std::cout << "num_keep_box: " << num_keep_box << std::endl;
+int Yolov5Impl::decode_raw_heads(RuntimeContext* context, const int batch_index, float* boxes, float* scores,
+                                 int* labels){
+    int num_proposals = 0;
+    for (int i = 0; i < 3; ++i) {
+        // heads are [N, 3, grid_h, grid_w, 5 + num_classes], grid and stride follow the input shape
+        const int output_index = context->head_outputs[i];
+        const TensorShape& head_shape = context->runtime->GetOutputTensor(output_index)->GetShape();
+        const int num_grid_h = head_shape.GetDim(2);
+        const int num_grid_w = head_shape.GetDim(3);
+        const int stride = context->input_height / num_grid_h;
 
-        for (size_t i = 0; i < num_keep_box; ++i) {
-            detect_res.push_back(proposals[keep_index[i]]);
+        // decode the slice of this image
+        ScopedTimer timer(stats.stages[STAGE_DECODE_HEAD0 + i]);
+        const uint64_t image_output_size = head_shape.GetElementsExcludingPadding() / context->batch_size;
+        num_proposals += generate_proposals(anchors[i], num_grid_w, num_grid_h, stride,
+                                            context->outputs[output_index] + batch_index * image_output_size,
+                                            model_params.prob_threshold, model_params.num_classes,
+                                            boxes + num_proposals * 4, scores + num_proposals,
+                                            labels + num_proposals);
+    }
+    return num_proposals;
+}
+
+int Yolov5Impl::decode_fused(RuntimeContext* context, const int batch_index, float* boxes, float* scores,
+                             int* labels){
+    // rows are (cx, cy, w, h, obj, cls...) in input pixels with sigmoid and anchors already applied
+    const int output_index = context->head_outputs[0];
+    const TensorShape& shape = context->runtime->GetOutputTensor(output_index)->GetShape();
+    const int num_boxes = shape.GetDim(1);
+
+    ScopedTimer timer(stats.stages[STAGE_DECODE_HEAD0]);
+    return decode_fused_output(context->outputs[output_index] + (uint64_t)batch_index * num_boxes *
+                                                                   (model_params.num_classes + 5),
+                               num_boxes, model_params.num_classes, model_params.prob_threshold,
+                               boxes, scores, labels);
+}
+
+int Yolov5Impl::decode_parallel(RuntimeContext* context, const int batch_index, float* boxes, float* scores,
+                                int* labels){
+    const bool fused = context->output_layout == OUTPUT_LAYOUT_FUSED;
+    const int num_heads = fused ? 1 : 3;
+    const int offset = model_params.num_classes + 5;
+
+    // rows of every anchor plane in the order of the serial decode, so the merged proposals are the same
+    int num_planes = 0;
+    DecodeSlice planes[9];
+    int num_cells = 0;
+    for (int i = 0; i < num_heads; ++i) {
+        const int output_index = context->head_outputs[i];
+        const TensorShape& shape = context->runtime->GetOutputTensor(output_index)->GetShape();
+        const uint64_t image_output_size = shape.GetElementsExcludingPadding() / context->batch_size;
+        const float* output = context->outputs[output_index] + batch_index * image_output_size;
+
+        if (fused) {
+            planes[num_planes++] = {output, NULL, 1, 0, (int)shape.GetDim(1), 0, 0, 0};
+            num_cells += shape.GetDim(1);
+            continue;
         }
 
-        if (bbox_vec) {
-            free(bbox_vec);
-            bbox_vec = NULL;
+        const int num_grid_h = shape.GetDim(2);
+        const int num_grid_w = shape.GetDim(3);
+        for (int q = 0; q < 3; ++q) {
+            planes[num_planes++] = {output + q * num_grid_h * num_grid_w * offset, anchors[i].data() + q * 2,
+                                    num_grid_w, 0, num_grid_h, context->input_height / num_grid_h, 0, 0};
+            num_cells += num_grid_h * num_grid_w;
+        }
+    }
+
+    ScopedTimer timer(stats.stages[STAGE_DECODE_HEAD0]);
+
+    // a few slices per thread so the dynamic schedule evens out the dense rows, cut at row boundaries
+    const int slice_cells = std::max(kMinDecodeSliceCells, num_cells / (model_params.decode_threads * 4));
+    int num_slices = 0;
+    for (int p = 0; p < num_planes; ++p) {
+        const int slice_rows = std::max(1, slice_cells / planes[p].num_grid_w);
+        num_slices += (planes[p].row_end + slice_rows - 1) / slice_rows;
+    }
+
+    DecodeSlice* slices = context->scratch.alloc<DecodeSlice>(num_slices);
+    int num_slots = 0;
+    num_slices = 0;
+    for (int p = 0; p < num_planes; ++p) {
+        const int slice_rows = std::max(1, slice_cells / planes[p].num_grid_w);
+        for (int row = 0; row < planes[p].row_end; row += slice_rows) {
+            DecodeSlice& slice = slices[num_slices++];
+            slice = planes[p];
+            slice.row_begin = row;
+            slice.row_end = std::min(row + slice_rows, planes[p].row_end);
+            slice.first_slot = num_slots;
+            num_slots += (slice.row_end - slice.row_begin) * slice.num_grid_w;
         }
+    }
+
+    // the runtime's cores idle until this context is released, the decode team runs there whichever thread
+    // calls, the one that ran the kernels (already bound, nothing to do) or a pipeline stage. The binding is
+    // the one of run_network, num_threads below sizes the team, so the two never undo each other
+    ensure_current_thread_bound(context->cpus, model_params.num_threads);
 
-        if (scores_vec) {
-            free(scores_vec);
-            scores_vec = NULL;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(model_params.decode_threads) schedule(dynamic, 1)
+#endif
+    for (int k = 0; k < num_slices; ++k) {
+        DecodeSlice& slice = slices[k];
+        float* slice_boxes = boxes + slice.first_slot * 4;
+        float* slice_scores = scores + slice.first_slot;
+        int* slice_labels = labels + slice.first_slot;
+        if (slice.anchor == NULL) {
+            slice.num_proposals = decode_fused_output(slice.output + (uint64_t)slice.row_begin * offset,
+                                                      slice.row_end - slice.row_begin, model_params.num_classes,
+                                                      model_params.prob_threshold, slice_boxes, slice_scores,
+                                                      slice_labels);
+        } else {
+            slice.num_proposals = generate_proposals_rows(slice.anchor[0], slice.anchor[1], slice.num_grid_w,
+                                                          slice.row_begin, slice.row_end, slice.stride, slice.output,
+                                                          model_params.prob_threshold, model_params.num_classes,
+                                                          slice_boxes, slice_scores, slice_labels);
         }
- 
-        if (keep_index) {
-            free(keep_index);
-            keep_index = NULL;
+    }
+
+    // every slice owns its slots, compacting them front to back needs no lock and never overwrites a proposal
+    int num_proposals = 0;
+    for (int k = 0; k < num_slices; ++k) {
+        const DecodeSlice& slice = slices[k];
+        if (slice.first_slot != num_proposals && slice.num_proposals > 0) {
+            memmove(boxes + num_proposals * 4, boxes + slice.first_slot * 4, slice.num_proposals * 4 * sizeof(float));
+            memmove(scores + num_proposals, scores + slice.first_slot, slice.num_proposals * sizeof(float));
+            memmove(labels + num_proposals, labels + slice.first_slot, slice.num_proposals * sizeof(int));
         }
+        num_proposals += slice.num_proposals;
     }
 
-    //detect_res = proposals;
+    return num_proposals;
 }
 
-Yolov5Impl::~Yolov5Impl(){
-    context.reset();
-    input_tensor.reset();
+RetCode Yolov5Impl::postprecess(RuntimeContext* context, const int batch_index, Detections& detections){
+    if (context == NULL || batch_index < 0 || batch_index >= context->batch_size)
+        return RC_INVALID_VALUE; 
+
+    const int batch_size = context->batch_size;
+
+    if (context->output_layout == OUTPUT_LAYOUT_UNKNOWN) {
+        RetCode retcode = resolve_output_layout(context);
+        if (retcode != RC_SUCCESS)
+            return retcode;
+    }
+    const bool fused = context->output_layout == OUTPUT_LAYOUT_FUSED;
 
-    if (in_data) {
-        free(in_data);
-        in_data = NULL;
+    // every cell of every head, or every row of the fused output, may become a proposal
+    uint64_t max_num_proposals = 0;
+    for (int i = 0; i < (fused ? 1 : 3); ++i) {
+        max_num_proposals += context->runtime->GetOutputTensor(context->head_outputs[i])->GetShape().GetElementsExcludingPadding() / batch_size / (model_params.num_classes + 5);
     }
+
+    // all per frame buffers come from the arena of the runtime, no heap allocation once it has grown
+    ScratchArena& scratch = context->scratch;
+    scratch.reset();
+    float* proposal_boxes  = scratch.alloc<float>(max_num_proposals * 4);
+    float* proposal_scores = scratch.alloc<float>(max_num_proposals);
+    int* proposal_labels   = scratch.alloc<int>(max_num_proposals);
+
+    int num_proposals = 0;
+    if (model_params.decode_threads > 1)
+        num_proposals = decode_parallel(context, batch_index, proposal_boxes, proposal_scores, proposal_labels);
+    else if (fused)
+        num_proposals = decode_fused(context, batch_index, proposal_boxes, proposal_scores, proposal_labels);
+    else
+        num_proposals = decode_raw_heads(context, batch_index, proposal_boxes, proposal_scores, proposal_labels);
+
+    stats.images.fetch_add(1, std::memory_order_relaxed);
+    stats.proposals.fetch_add(num_proposals, std::memory_order_relaxed);
+    ScopedTimer nms_timer(stats.stages[STAGE_NMS]);
+
+    //nms, then back to image coordinates
+    const int num_keep_box = select_detections(proposal_boxes, proposal_scores, proposal_labels, num_proposals,
+                                               model_params.pre_nms_topk, model_params.nms_threshold,
+                                               model_params.class_agnostic, model_params.max_det,
+                                               context->letterbox[batch_index], &scratch, &detections);
+
+    const int num_nms_inputs = model_params.pre_nms_topk > 0 ? std::min(num_proposals, model_params.pre_nms_topk)
+                                                               : num_proposals;
+    stats.nms_inputs.fetch_add(num_nms_inputs, std::memory_order_relaxed);
+    stats.detections.fetch_add(num_keep_box, std::memory_order_relaxed);
+    YOLOV5_LOG("num_keep_box: %d\n", num_keep_box);
+
+    return RC_SUCCESS;
+}
+
+Yolov5Impl::~Yolov5Impl(){
+    // runtimes have to go before the builder and the engine they were created from
+    idle_runtimes.clear();
+    runtime_pool.clear();
+    builder.reset();
+    x86_engine.reset();
 }
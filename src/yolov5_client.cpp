@@ -0,0 +1,151 @@
+#include "yolov5_client.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace ppl::common;
+
+// one packet with a file descriptor passed along
+static bool send_with_fd(const int fd, const void* data, const size_t size, const int passed_fd) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)size;
+}
+
+RetCode Yolov5Client::connect(const char* socket_path, const uint32_t num_slots, const uint64_t slot_bytes) {
+    if (socket_path == NULL || num_slots == 0 || slot_bytes == 0 || fd >= 0)
+        return RC_INVALID_VALUE;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return RC_INVALID_VALUE;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "cannot connect to %s: %s\n", socket_path, strerror(errno));
+        close();
+        return RC_OTHER_ERROR;
+    }
+
+    // anonymous shared memory, the server maps it through the descriptor sent with the hello
+    const uint64_t bytes = num_slots * slot_bytes;
+    // sealed at its size, the server maps it and must not fault on pages a shrink took away
+    int memfd = memfd_create("yolov5_slots", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, bytes) != 0 || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+        fprintf(stderr, "cannot create %lu bytes of shared memory: %s\n", (unsigned long)bytes, strerror(errno));
+        if (memfd >= 0)
+            ::close(memfd);
+        close();
+        return RC_OUT_OF_MEMORY;
+    }
+
+    void* mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (mapping == MAP_FAILED) {
+        ::close(memfd);
+        close();
+        return RC_OUT_OF_MEMORY;
+    }
+    slots = static_cast<uint8_t*>(mapping);
+    this->num_slots = num_slots;
+    this->slot_bytes = slot_bytes;
+
+    IpcHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic      = kIpcMagic;
+    hello.version    = kIpcVersion;
+    hello.num_slots  = num_slots;
+    hello.slot_bytes = slot_bytes;
+    const bool sent = send_with_fd(fd, &hello, sizeof(hello), memfd);
+    ::close(memfd);
+
+    IpcHelloReply reply;
+    if (!sent || recv(fd, &reply, sizeof(reply), 0) != sizeof(reply) || reply.magic != kIpcMagic ||
+        reply.status != IPC_OK) {
+        fprintf(stderr, "server at %s refused the connection\n", socket_path);
+        close();
+        return RC_OTHER_ERROR;
+    }
+
+    max_batch = reply.max_batch;
+    message.resize(sizeof(IpcResponse) + reply.max_detections * sizeof(IpcDetection));
+    return RC_SUCCESS;
+}
+
+void Yolov5Client::close() {
+    if (slots)
+        munmap(slots, num_slots * slot_bytes);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    slots = NULL;
+    num_slots = 0;
+    slot_bytes = 0;
+}
+
+RetCode Yolov5Client::submit(const uint32_t slot, const uint64_t request_id, const int width, const int height,
+                             const int stride, const int64_t budget_us) {
+    if (fd < 0 || slot >= num_slots)
+        return RC_INVALID_VALUE;
+
+    IpcRequest request;
+    memset(&request, 0, sizeof(request));
+    request.request_id  = request_id;
+    request.slot        = slot;
+    request.width       = width;
+    request.height      = height;
+    request.stride      = stride;
+    request.deadline_ns = budget_us > 0 ? ipc_now_ns() + budget_us * 1000 : 0;
+
+    if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)) {
+        fprintf(stderr, "send request failed: %s\n", strerror(errno));
+        return RC_OTHER_ERROR;
+    }
+    return RC_SUCCESS;
+}
+
+RetCode Yolov5Client::receive(IpcResponse* response, std::vector<IpcDetection>* detections) {
+    if (fd < 0 || response == NULL)
+        return RC_INVALID_VALUE;
+
+    ssize_t received = recv(fd, message.data(), message.size(), 0);
+    if (received < (ssize_t)sizeof(IpcResponse)) {
+        if (received != 0)
+            fprintf(stderr, "receive response failed: %s\n", received < 0 ? strerror(errno) : "truncated");
+        return RC_OTHER_ERROR;
+    }
+
+    memcpy(response, message.data(), sizeof(IpcResponse));
+    const IpcDetection* records = reinterpret_cast<const IpcDetection*>(message.data() + sizeof(IpcResponse));
+    const uint32_t num_records = (received - sizeof(IpcResponse)) / sizeof(IpcDetection);
+    response->num_detections = std::min(response->num_detections, num_records);
+    if (detections)
+        detections->assign(records, records + response->num_detections);
+    return RC_SUCCESS;
+}
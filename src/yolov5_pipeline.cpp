@@ -0,0 +1,139 @@
+#include "yolov5_pipeline.h"
+
+#include <stdexcept>
+
+using namespace ppl::common;
+
+void Yolov5Pipeline::push_blocking(SpscQueue<PipelineTask*>& queue, StageSignal& signal, PipelineTask* task) {
+    signal.wait([&queue, task]() { return queue.push(task); });
+    signal.notify();
+}
+
+// NULL once producer_done is set and the queue is drained
+Yolov5Pipeline::PipelineTask* Yolov5Pipeline::pop_blocking(SpscQueue<PipelineTask*>& queue, StageSignal& signal,
+                                                           const std::atomic<bool>& producer_done) {
+    PipelineTask* task = NULL;
+    signal.wait([&queue, &producer_done, &task]() {
+        return queue.pop(task) || (producer_done.load(std::memory_order_acquire) && queue.empty());
+    });
+    if (task)
+        signal.notify();
+    return task;
+}
+
+Yolov5Pipeline::Yolov5Pipeline(Yolov5Impl* impl, const int queue_depth)
+    : impl(impl),
+      preprocess_queue(queue_depth),
+      run_queue(queue_depth),
+      postprocess_queue(queue_depth),
+      stopping(false),
+      preprocess_done(false),
+      run_done(false) {
+    preprocess_thread  = std::thread(&Yolov5Pipeline::preprocess_loop, this);
+    run_thread         = std::thread(&Yolov5Pipeline::run_loop, this);
+    postprocess_thread = std::thread(&Yolov5Pipeline::postprocess_loop, this);
+}
+
+Yolov5Pipeline::~Yolov5Pipeline() {
+    stopping.store(true, std::memory_order_release);
+    preprocess_signal.notify();
+
+    preprocess_thread.join();
+    run_thread.join();
+    postprocess_thread.join();
+}
+
+std::future<std::vector<DetectRes>> Yolov5Pipeline::submit(const cv::Mat& src) {
+    PipelineTask* task = new PipelineTask();
+    task->src = src;
+    task->context = NULL;
+    std::future<std::vector<DetectRes>> result = task->promise.get_future();
+
+    if (src.empty()) {
+        fail_task(task, RC_INVALID_VALUE);
+        return result;
+    }
+
+    std::lock_guard<std::mutex> lock(submit_mutex);
+    push_blocking(preprocess_queue, preprocess_signal, task);
+    return result;
+}
+
+void Yolov5Pipeline::fail_task(PipelineTask* task, RetCode retcode) {
+    if (task->context) {
+        impl->release_runtime(task->context);
+    }
+
+    task->promise.set_exception(std::make_exception_ptr(std::runtime_error(GetRetCodeStr(retcode))));
+    delete task;
+}
+
+void Yolov5Pipeline::preprocess_loop() {
+    for (;;) {
+        PipelineTask* task = pop_blocking(preprocess_queue, preprocess_signal, stopping);
+        if (task == NULL)
+            break;
+
+        // the runtime stays with the frame until postprocess has read its outputs
+        int height, width;
+        impl->input_shape_for(task->src, &height, &width);
+        task->context = impl->acquire_runtime(1, height, width);
+        if (task->context == NULL) {
+            fail_task(task, RC_INVALID_VALUE);
+            continue;
+        }
+
+        RetCode retcode = impl->reshape_input(task->context, 1, height, width);
+        if (retcode == RC_SUCCESS) {
+            retcode = impl->preprocess(task->src, task->context, 0);
+        }
+        if (retcode != RC_SUCCESS) {
+            fail_task(task, retcode);
+            continue;
+        }
+
+        task->src.release();
+        push_blocking(run_queue, run_signal, task);
+    }
+
+    preprocess_done.store(true, std::memory_order_release);
+    run_signal.notify();
+}
+
+void Yolov5Pipeline::run_loop() {
+    for (;;) {
+        PipelineTask* task = pop_blocking(run_queue, run_signal, preprocess_done);
+        if (task == NULL)
+            break;
+
+        RetCode retcode = impl->run_network(task->context);
+        if (retcode != RC_SUCCESS) {
+            fail_task(task, retcode);
+            continue;
+        }
+
+        push_blocking(postprocess_queue, postprocess_signal, task);
+    }
+
+    run_done.store(true, std::memory_order_release);
+    postprocess_signal.notify();
+}
+
+void Yolov5Pipeline::postprocess_loop() {
+    for (;;) {
+        PipelineTask* task = pop_blocking(postprocess_queue, postprocess_signal, run_done);
+        if (task == NULL)
+            break;
+
+        std::vector<DetectRes> detect_res;
+        RetCode retcode = impl->postprecess(task->context, 0, detect_res);
+        if (retcode != RC_SUCCESS) {
+            fail_task(task, retcode);
+            continue;
+        }
+
+        impl->release_runtime(task->context);
+        task->promise.set_value(std::move(detect_res));
+        delete task;
+    }
+}
@@ -0,0 +1,414 @@
+#include "yolov5_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+
+using namespace ppl::common;
+
+// bounds of the slot memory a client may ask the server to map
+static const uint32_t kMaxSlots = 4096;
+static const uint64_t kMaxSlotBytes = 1ull << 30;
+
+/**
+* \brief One client, its socket and the mapping of its frame slots
+*
+* Queued requests keep the connection alive, so neither the socket nor the mapping goes
+* away under a running batch when the client disconnects.
+*/
+struct Yolov5Server::Connection{
+    int fd;
+    uint8_t* slots;              ///< read only mapping of the memfd of the client
+    uint64_t mapped_bytes;
+    uint32_t num_slots;
+    uint64_t slot_bytes;
+    std::thread thread;          ///< reads the requests of this client
+    std::atomic<bool> closed;    ///< the thread is done and may be joined
+    std::atomic<bool> stalled;   ///< stopped reading its responses and was shut down
+
+    Connection() : fd(-1), slots(NULL), mapped_bytes(0), num_slots(0), slot_bytes(0), closed(false), stalled(false) {}
+    ~Connection() {
+        if (slots)
+            munmap(slots, mapped_bytes);
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+static IpcResponse make_response(const uint64_t request_id, const IpcStatus status) {
+    IpcResponse response;
+    memset(&response, 0, sizeof(response));
+    response.request_id = request_id;
+    response.status = status;
+    return response;
+}
+
+// one packet together with the file descriptor passed along with it, received_fd is -1 when there is none
+static ssize_t recv_with_fd(const int fd, void* data, const size_t size, int* received_fd) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *received_fd = -1;
+    ssize_t received = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); received >= 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(received_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return received;
+}
+
+Yolov5Server::Yolov5Server(Yolov5Impl* impl, const ServerParams& params)
+    : impl(impl),
+      params(params),
+      listen_fd(-1),
+      stopping(false),
+      num_connections(0),
+      requests(0),
+      completed(0),
+      batches(0),
+      expired(0),
+      overloaded(0),
+      invalid(0),
+      failed(0) {
+    this->params.max_batch    = params.max_batch > 0 ? params.max_batch : 1;
+    this->params.max_wait_us  = params.max_wait_us > 0 ? params.max_wait_us : 0;
+    this->params.num_batchers = params.num_batchers > 0 ? params.num_batchers : 1;
+}
+
+Yolov5Server::~Yolov5Server() {
+    stop();
+}
+
+RetCode Yolov5Server::start() {
+    if (impl == NULL || params.socket_path == NULL || listen_fd >= 0)
+        return RC_INVALID_VALUE;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(params.socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path %s is too long\n", params.socket_path);
+        return RC_INVALID_VALUE;
+    }
+    strcpy(addr.sun_path, params.socket_path);
+
+    // packets keep their boundaries, so every request and response is one send and one recv
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        fprintf(stderr, "cannot create socket: %s\n", strerror(errno));
+        return RC_OTHER_ERROR;
+    }
+
+    unlink(params.socket_path);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", params.socket_path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return RC_OTHER_ERROR;
+    }
+
+    stopping = false;
+    accept_thread = std::thread(&Yolov5Server::accept_loop, this);
+    for (int i = 0; i < params.num_batchers; ++i) {
+        batcher_threads.push_back(std::thread(&Yolov5Server::batcher_loop, this));
+    }
+
+    YOLOV5_LOG("listening on %s\n", params.socket_path);
+    return RC_SUCCESS;
+}
+
+void Yolov5Server::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+        queue.clear();
+    }
+    queue_cond.notify_all();
+
+    // no connection is added once the accept thread is gone
+    if (listen_fd >= 0)
+        shutdown(listen_fd, SHUT_RDWR);
+    if (accept_thread.joinable())
+        accept_thread.join();
+
+    for (std::thread& thread : batcher_threads)
+        thread.join();
+    batcher_threads.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for (auto& connection : connections)
+            shutdown(connection->fd, SHUT_RDWR);
+        for (auto& connection : connections)
+            connection->thread.join();
+        connections.clear();
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(params.socket_path);
+    }
+}
+
+ServerCounters Yolov5Server::get_counters() const {
+    ServerCounters counters;
+    counters.connections = num_connections.load(std::memory_order_relaxed);
+    counters.requests    = requests.load(std::memory_order_relaxed);
+    counters.completed   = completed.load(std::memory_order_relaxed);
+    counters.batches     = batches.load(std::memory_order_relaxed);
+    counters.expired     = expired.load(std::memory_order_relaxed);
+    counters.overloaded  = overloaded.load(std::memory_order_relaxed);
+    counters.invalid     = invalid.load(std::memory_order_relaxed);
+    counters.failed      = failed.load(std::memory_order_relaxed);
+    return counters;
+}
+
+void Yolov5Server::accept_loop() {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break; // shut down by stop
+        }
+
+        std::shared_ptr<Connection> connection(new Connection());
+        connection->fd = fd;
+        num_connections.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(connections_mutex);
+
+        // join the readers of the clients which left
+        for (size_t i = 0; i < connections.size();) {
+            if (connections[i]->closed) {
+                connections[i]->thread.join();
+                connections.erase(connections.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+
+        connection->thread = std::thread(&Yolov5Server::connection_loop, this, connection);
+        connections.push_back(connection);
+    }
+}
+
+void Yolov5Server::connection_loop(std::shared_ptr<Connection> connection) {
+    IpcHello hello;
+    int memfd = -1;
+    ssize_t received = recv_with_fd(connection->fd, &hello, sizeof(hello), &memfd);
+
+    IpcHelloReply reply;
+    reply.magic          = kIpcMagic;
+    reply.status         = IPC_INVALID;
+    reply.max_batch      = params.max_batch;
+    reply.max_detections = kIpcMaxDetections;
+
+    // the slots are mapped once, requests then only name a slot
+    if (received == sizeof(hello) && memfd >= 0 && hello.magic == kIpcMagic && hello.version == kIpcVersion &&
+        hello.num_slots > 0 && hello.num_slots <= kMaxSlots && hello.slot_bytes > 0 &&
+        hello.slot_bytes <= kMaxSlotBytes) {
+        // a client could shrink an unsealed memfd under the mapping and fault the batcher with SIGBUS
+        const uint64_t bytes = hello.num_slots * hello.slot_bytes;
+        const int seals = fcntl(memfd, F_GET_SEALS);
+        struct stat st;
+        if (seals >= 0 && (seals & F_SEAL_SHRINK) && fstat(memfd, &st) == 0 && (uint64_t)st.st_size >= bytes) {
+            void* slots = mmap(NULL, bytes, PROT_READ, MAP_SHARED, memfd, 0);
+            if (slots != MAP_FAILED) {
+                connection->slots        = static_cast<uint8_t*>(slots);
+                connection->mapped_bytes = bytes;
+                connection->num_slots    = hello.num_slots;
+                connection->slot_bytes   = hello.slot_bytes;
+                reply.status = IPC_OK;
+            }
+        }
+    }
+    if (memfd >= 0)
+        close(memfd);
+
+    send(connection->fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+    if (reply.status != IPC_OK) {
+        fprintf(stderr, "refused a client with an invalid hello\n");
+        connection->closed = true;
+        return;
+    }
+
+    for (;;) {
+        // zeroed, a short packet is answered with IPC_INVALID and must not echo stack bytes as its request_id
+        PendingRequest pending;
+        memset(&pending.request, 0, sizeof(pending.request));
+        received = recv(connection->fd, &pending.request, sizeof(pending.request), 0);
+        if (received <= 0)
+            break; // client gone or stop
+
+        requests.fetch_add(1, std::memory_order_relaxed);
+        const IpcRequest& request = pending.request;
+        // in 64 bits, width * 3 of a hostile int32 width overflows an int and would pass the bounds
+        const int64_t row_bytes = (int64_t)request.width * 3;
+        const int64_t last_row = request.height > 0 ? (int64_t)request.stride * (request.height - 1) : 0;
+        if (received != sizeof(request) || request.slot >= connection->num_slots || request.width <= 0 ||
+            request.height <= 0 || request.stride < row_bytes ||
+            last_row + row_bytes > (int64_t)connection->slot_bytes) {
+            invalid.fetch_add(1, std::memory_order_relaxed);
+            respond(connection.get(), make_response(request.request_id, IPC_INVALID), NULL);
+            continue;
+        }
+
+        pending.connection  = connection;
+        pending.arrival_ns  = ipc_now_ns();
+        pending.deadline_ns = request.deadline_ns;
+        if (pending.deadline_ns == 0 && params.default_budget_us > 0)
+            pending.deadline_ns = pending.arrival_ns + params.default_budget_us * 1000;
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (stopping)
+                break;
+            if (params.max_queue <= 0 || (int)queue.size() < params.max_queue) {
+                queue.push_back(std::move(pending));
+                pending.connection.reset();
+            }
+        }
+
+        // still set when the queue had no room
+        if (pending.connection) {
+            overloaded.fetch_add(1, std::memory_order_relaxed);
+            respond(connection.get(), make_response(request.request_id, IPC_OVERLOADED), NULL);
+            continue;
+        }
+        queue_cond.notify_one();
+    }
+
+    connection->closed = true;
+}
+
+bool Yolov5Server::take_batch(std::vector<PendingRequest>* batch, std::vector<PendingRequest>* expired_requests) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queue_cond.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (stopping)
+        return false;
+
+    // the batch leaves once it is full or its oldest request waited max_wait_us
+    const int64_t wait_ns = queue.front().arrival_ns + params.max_wait_us * 1000 - ipc_now_ns();
+    if ((int)queue.size() < params.max_batch && wait_ns > 0) {
+        queue_cond.wait_for(lock, std::chrono::nanoseconds(wait_ns), [this] {
+            return stopping || (int)queue.size() >= params.max_batch;
+        });
+        if (stopping)
+            return false;
+    }
+
+    // requests past their deadline are shed here, running them would only delay the ones behind
+    const int64_t now_ns = ipc_now_ns();
+    while (!queue.empty() && (int)batch->size() < params.max_batch) {
+        PendingRequest& pending = queue.front();
+        if (pending.deadline_ns != 0 && now_ns >= pending.deadline_ns)
+            expired_requests->push_back(std::move(pending));
+        else
+            batch->push_back(std::move(pending));
+        queue.pop_front();
+    }
+
+    // what is left is the start of the next batch
+    if (!queue.empty())
+        queue_cond.notify_one();
+    return true;
+}
+
+void Yolov5Server::batcher_loop() {
+    std::vector<PendingRequest> batch;
+    std::vector<PendingRequest> expired_requests;
+    std::vector<cv::Mat> srcs;
+    std::vector<Detections> results;
+
+    for (;;) {
+        batch.clear();
+        expired_requests.clear();
+        if (!take_batch(&batch, &expired_requests))
+            return;
+
+        for (PendingRequest& pending : expired_requests)
+            respond(pending.connection.get(), make_response(pending.request.request_id, IPC_EXPIRED), NULL);
+        expired.fetch_add(expired_requests.size(), std::memory_order_relaxed);
+        if (batch.empty())
+            continue;
+
+        // the pixels are read straight from the slots of the clients
+        srcs.clear();
+        for (const PendingRequest& pending : batch) {
+            const IpcRequest& request = pending.request;
+            uint8_t* slot = pending.connection->slots + request.slot * pending.connection->slot_bytes;
+            srcs.push_back(cv::Mat(request.height, request.width, CV_8UC3, slot, request.stride));
+        }
+
+        const int64_t start_ns = ipc_now_ns();
+        RetCode retcode = impl->yolov5_network_detect_batch(srcs, results);
+        const int64_t detect_ns = ipc_now_ns() - start_ns;
+        batches.fetch_add(1, std::memory_order_relaxed);
+        if (retcode != RC_SUCCESS)
+            fprintf(stderr, "batch of %zu failed: %s\n", batch.size(), GetRetCodeStr(retcode));
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            IpcResponse response = make_response(batch[i].request.request_id,
+                                                 retcode == RC_SUCCESS ? IPC_OK : IPC_FAILED);
+            response.batch_size = batch.size();
+            response.queue_ns   = start_ns - batch[i].arrival_ns;
+            response.detect_ns  = detect_ns;
+            respond(batch[i].connection.get(), response, retcode == RC_SUCCESS ? &results[i] : NULL);
+        }
+
+        if (retcode == RC_SUCCESS)
+            completed.fetch_add(batch.size(), std::memory_order_relaxed);
+        else
+            failed.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+}
+
+void Yolov5Server::respond(Connection* connection, const IpcResponse& response, const Detections* detections) {
+    thread_local std::vector<char> message;
+
+    const uint32_t num_detections = detections ? std::min<size_t>(detections->size(), kIpcMaxDetections) : 0;
+    message.resize(sizeof(IpcResponse) + num_detections * sizeof(IpcDetection));
+
+    IpcResponse* header = reinterpret_cast<IpcResponse*>(message.data());
+    *header = response;
+    header->num_detections = num_detections;
+
+    IpcDetection* records = reinterpret_cast<IpcDetection*>(header + 1);
+    for (uint32_t i = 0; i < num_detections; ++i) {
+        records[i].x1    = detections->x1[i];
+        records[i].y1    = detections->y1[i];
+        records[i].x2    = detections->x2[i];
+        records[i].y2    = detections->y2[i];
+        records[i].score = detections->score[i];
+        records[i].label = detections->label[i];
+    }
+
+    // one packet per response, concurrent senders never interleave; a client which left is not an error.
+    // A client which stopped reading must not block a batcher and with it every other client, its response
+    // is dropped and the connection shut down, which also ends its reader
+    if (send(connection->fd, message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+        (errno == EAGAIN || errno == EWOULDBLOCK) && !connection->stalled.exchange(true)) {
+        fprintf(stderr, "disconnecting a client which does not read its responses\n");
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+}
@@ -0,0 +1,219 @@
+#include "yolov5_stream.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+using namespace ppl::common;
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_us(const Clock::time_point& start, const Clock::time_point& end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+Yolov5Stream::Yolov5Stream(Yolov5Impl* impl, const StreamParams& params, ResultCallback on_result)
+    : impl(impl),
+      params(params),
+      on_result(on_result),
+      decode_done(false),
+      stopping(false),
+      decoded(0),
+      processed(0),
+      dropped_full(0),
+      dropped_stale(0),
+      failed(0) {
+    this->params.capacity    = params.capacity > 0 ? params.capacity : 1;
+    this->params.num_workers = params.num_workers > 0 ? params.num_workers : 1;
+}
+
+Yolov5Stream::~Yolov5Stream() {
+    stop();
+}
+
+RetCode Yolov5Stream::start(const char* source) {
+    if (source == NULL || decode_thread.joinable())
+        return RC_INVALID_VALUE;
+
+    bool is_camera = *source != '\0';
+    for (const char* p = source; *p; ++p) {
+        if (!isdigit(static_cast<unsigned char>(*p)))
+            is_camera = false;
+    }
+
+    bool opened = is_camera ? capture.open(atoi(source)) : capture.open(source);
+    if (!opened) {
+        fprintf(stderr, "cannot open video source %s\n", source);
+        return RC_INVALID_VALUE;
+    }
+
+    decode_done = false;
+    stopping = false;
+    decode_thread = std::thread(&Yolov5Stream::decode_loop, this);
+    for (int i = 0; i < params.num_workers; ++i) {
+        worker_threads.push_back(std::thread(&Yolov5Stream::worker_loop, this));
+    }
+
+    return RC_SUCCESS;
+}
+
+void Yolov5Stream::wait() {
+    if (decode_thread.joinable())
+        decode_thread.join();
+    for (auto& worker : worker_threads)
+        worker.join();
+    worker_threads.clear();
+}
+
+void Yolov5Stream::stop() {
+    {
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        stopping = true;
+        ring.clear();
+    }
+    ring_not_empty.notify_all();
+    ring_not_full.notify_all();
+
+    wait();
+    capture.release();
+}
+
+StreamCounters Yolov5Stream::get_counters() const {
+    StreamCounters counters;
+    counters.decoded       = decoded.load(std::memory_order_relaxed);
+    counters.processed     = processed.load(std::memory_order_relaxed);
+    counters.dropped_full  = dropped_full.load(std::memory_order_relaxed);
+    counters.dropped_stale = dropped_stale.load(std::memory_order_relaxed);
+    counters.failed        = failed.load(std::memory_order_relaxed);
+    return counters;
+}
+
+void Yolov5Stream::decode_loop() {
+    // files decode much faster than they play, pacing turns them into a live source
+    double fps = params.realtime ? capture.get(cv::CAP_PROP_FPS) : 0.0;
+    const Clock::duration frame_interval = fps > 0.0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps))
+        : Clock::duration::zero();
+    const Clock::time_point begin = Clock::now();
+
+    for (int64_t index = 0;; ++index) {
+        StreamFrame frame;
+        {
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            if (stopping)
+                break;
+            if (!free_images.empty()) {
+                frame.image = free_images.back();
+                free_images.pop_back();
+            }
+        }
+
+        if (frame_interval != Clock::duration::zero())
+            std::this_thread::sleep_until(begin + index * frame_interval);
+
+        // reuses the buffer of a consumed frame when nobody else holds it
+        if (!capture.read(frame.image) || frame.image.empty())
+            break;
+
+        frame.capture_time   = Clock::now();
+        frame.index          = index;
+        frame.stream_time_ms = capture.get(cv::CAP_PROP_POS_MSEC);
+        decoded.fetch_add(1, std::memory_order_relaxed);
+
+        push_frame(frame);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        decode_done = true;
+    }
+    ring_not_empty.notify_all();
+}
+
+void Yolov5Stream::push_frame(StreamFrame& frame) {
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    if (static_cast<int>(ring.size()) >= params.capacity) {
+        switch (params.drop_policy) {
+            case STREAM_DROP_OLDEST:
+                free_images.push_back(ring.front().image);
+                ring.pop_front();
+                dropped_full.fetch_add(1, std::memory_order_relaxed);
+                break;
+            case STREAM_DROP_NEWEST:
+                free_images.push_back(frame.image);
+                dropped_full.fetch_add(1, std::memory_order_relaxed);
+                return;
+            case STREAM_BLOCK:
+            default:
+                ring_not_full.wait(lock, [this] { return static_cast<int>(ring.size()) < params.capacity || stopping; });
+                if (stopping)
+                    return;
+                break;
+        }
+    }
+
+    ring.push_back(std::move(frame));
+    lock.unlock();
+    ring_not_empty.notify_one();
+}
+
+void Yolov5Stream::recycle_image(cv::Mat& image) {
+    // a callback that kept a reference (a copy of result.frame) still reads these pixels, the decoder must not
+    // overwrite them, so only buffers nobody else holds go back to the pool
+    if (image.u == NULL || image.u->refcount != 1) {
+        image.release();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    if (static_cast<int>(free_images.size()) < params.capacity + params.num_workers)
+        free_images.push_back(image);
+    image.release();
+}
+
+void Yolov5Stream::worker_loop() {
+    for (;;) {
+        StreamFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(ring_mutex);
+            ring_not_empty.wait(lock, [this] { return !ring.empty() || decode_done || stopping; });
+            if (stopping || ring.empty())
+                break;
+
+            frame = std::move(ring.front());
+            ring.pop_front();
+        }
+        ring_not_full.notify_one();
+
+        StreamResult result;
+        result.frame_index    = frame.index;
+        result.stream_time_ms = frame.stream_time_ms;
+        result.capture_time   = frame.capture_time;
+        result.queue_us       = elapsed_us(frame.capture_time, Clock::now());
+
+        // late results are worth less than fresh ones, skip the frame instead of adding to the backlog
+        if (params.latency_budget_us > 0 && result.queue_us > params.latency_budget_us) {
+            dropped_stale.fetch_add(1, std::memory_order_relaxed);
+            recycle_image(frame.image);
+            continue;
+        }
+
+        RetCode retcode = impl->yolov5_network_detect(frame.image, result.detect_res);
+        if (retcode != RC_SUCCESS) {
+            fprintf(stderr, "detect frame %ld failed: %s\n", (long)frame.index, GetRetCodeStr(retcode));
+            failed.fetch_add(1, std::memory_order_relaxed);
+            recycle_image(frame.image);
+            continue;
+        }
+
+        result.latency_us = elapsed_us(frame.capture_time, Clock::now());
+        result.dropped    = dropped_full.load(std::memory_order_relaxed) + dropped_stale.load(std::memory_order_relaxed);
+        result.frame      = frame.image;
+        processed.fetch_add(1, std::memory_order_relaxed);
+
+        if (on_result)
+            on_result(result);
+
+        result.frame.release();
+        recycle_image(frame.image);
+    }
+}
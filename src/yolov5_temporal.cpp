@@ -0,0 +1,111 @@
+#include "yolov5_temporal.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace ppl::common;
+
+// pixels sampled per cell along each axis, enough for a stable mean at a fraction of a full pass
+static const int kSamplesPerCellSide = 8;
+
+Yolov5Temporal::Yolov5Temporal(Yolov5Impl* impl, const TemporalParams& params)
+    : impl(impl),
+      params(params),
+      has_reference(false),
+      frames_since_inference(0),
+      frames(0),
+      inferred(0),
+      skipped(0) {
+    this->params.grid_width  = params.grid_width > 0 ? params.grid_width : 1;
+    this->params.grid_height = params.grid_height > 0 ? params.grid_height : 1;
+
+    reference_grid.resize(this->params.grid_width * this->params.grid_height);
+    grid.resize(reference_grid.size());
+}
+
+void Yolov5Temporal::reset() {
+    has_reference = false;
+}
+
+TemporalCounters Yolov5Temporal::get_counters() const {
+    TemporalCounters counters;
+    counters.frames   = frames.load(std::memory_order_relaxed);
+    counters.inferred = inferred.load(std::memory_order_relaxed);
+    counters.skipped  = skipped.load(std::memory_order_relaxed);
+    return counters;
+}
+
+void Yolov5Temporal::compute_grid(const cv::Mat& src, float* cells) const {
+    const int grid_width = params.grid_width;
+    const int grid_height = params.grid_height;
+
+    for (int gy = 0; gy < grid_height; ++gy) {
+        const int y_begin = gy * src.rows / grid_height;
+        const int y_end = std::max((gy + 1) * src.rows / grid_height, y_begin + 1);
+        const int y_step = std::max((y_end - y_begin) / kSamplesPerCellSide, 1);
+
+        for (int gx = 0; gx < grid_width; ++gx) {
+            const int x_begin = gx * src.cols / grid_width;
+            const int x_end = std::max((gx + 1) * src.cols / grid_width, x_begin + 1);
+            const int x_step = std::max((x_end - x_begin) / kSamplesPerCellSide, 1);
+
+            // b + g + r of the samples, divided once per cell
+            uint32_t sum = 0;
+            uint32_t count = 0;
+            for (int y = y_begin; y < y_end && y < src.rows; y += y_step) {
+                const uint8_t* row = src.ptr<uint8_t>(y);
+                for (int x = x_begin; x < x_end && x < src.cols; x += x_step) {
+                    sum += row[x * 3] + row[x * 3 + 1] + row[x * 3 + 2];
+                    ++count;
+                }
+            }
+            cells[gy * grid_width + gx] = count ? sum / (3.f * count) : 0.f;
+        }
+    }
+}
+
+int Yolov5Temporal::count_changed_cells() const {
+    int changed = 0;
+    for (size_t i = 0; i < grid.size(); ++i) {
+        if (fabsf(grid[i] - reference_grid[i]) > params.cell_threshold)
+            ++changed;
+    }
+    return changed;
+}
+
+RetCode Yolov5Temporal::detect(cv::Mat& src, std::vector<DetectRes>& detect_res, bool* skipped_frame) {
+    if (skipped_frame)
+        *skipped_frame = false;
+    if (src.empty() || src.type() != CV_8UC3)
+        return RC_INVALID_VALUE;
+
+    frames.fetch_add(1, std::memory_order_relaxed);
+    compute_grid(src, grid.data());
+
+    // a quiet frame between keyframes gets the results of the frame the grid is compared with
+    const bool keyframe_due = params.keyframe_interval <= 1 || frames_since_inference + 1 >= params.keyframe_interval;
+    if (has_reference && !keyframe_due && src.size() == reference_size &&
+        count_changed_cells() <= params.max_changed_cells) {
+        ++frames_since_inference;
+        skipped.fetch_add(1, std::memory_order_relaxed);
+        detect_res.insert(detect_res.end(), last_res.begin(), last_res.end());
+        if (skipped_frame)
+            *skipped_frame = true;
+        return RC_SUCCESS;
+    }
+
+    last_res.clear();
+    RetCode retcode = impl->yolov5_network_detect(src, last_res);
+    if (retcode != RC_SUCCESS) {
+        has_reference = false;
+        return retcode;
+    }
+
+    inferred.fetch_add(1, std::memory_order_relaxed);
+    detect_res.insert(detect_res.end(), last_res.begin(), last_res.end());
+    reference_grid.swap(grid);
+    reference_size = src.size();
+    has_reference = true;
+    frames_since_inference = 0;
+    return RC_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include "detections.h"
+#include "preprocess.h"
+#include "scratch_arena.h"
+#include "utils.h"
+
+#include <atomic>
+#include <new>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+// every heap allocation of the process goes through here
+static std::atomic<uint64_t> num_allocations(0);
+
+void* operator new(size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+// one raw head [3, grid, grid, 85] where a `density` fraction of the cells pass the threshold
+static void fill_head(const float density, std::mt19937& rng, std::vector<float>& head) {
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    for (size_t cell = 0; cell < head.size() / 85; ++cell) {
+        float* p = head.data() + cell * 85;
+        for (int k = 0; k < 85; ++k)
+            p[k] = -6.f;
+        p[0] = uniform(rng) * 4.f - 2.f;
+        p[1] = uniform(rng) * 4.f - 2.f;
+        if (uniform(rng) < density) {
+            p[4] = 4.f;
+            p[5 + rng() % 80] = 2.f + uniform(rng);
+        }
+    }
+}
+
+// the host side of one yolov5_network_detect: the kernels of preprocess and decode_raw_heads, then the
+// same select_detections as postprecess, with the scratch buffers taken from arena
+static int detect_frame(const std::vector<uint8_t>& image, const int width, const int height,
+                        const std::vector<float>* heads, ScratchArena& arena, std::vector<float>& input,
+                        Detections& detections) {
+    static const std::vector<float> anchors[3] = {{10.f, 13.f, 16.f, 30.f, 33.f, 23.f},
+                                                  {30.f, 61.f, 62.f, 45.f, 59.f, 119.f},
+                                                  {116.f, 90.f, 156.f, 198.f, 373.f, 326.f}};
+    static const int num_grids[3] = {80, 40, 20};
+    const float mean[3] = {0.f, 0.f, 0.f};
+    const float std[3] = {255.f, 255.f, 255.f};
+
+    LetterboxInfo info;
+    arena.reset();
+    letterbox_bgr_to_planar(image.data(), width, height, width * 3, 640, 640, mean, std, input.data(), &info,
+                            arena.alloc<uint8_t>(letterbox_get_buffer_bytes(640, 640)));
+
+    const int max_num_proposals = 3 * (80 * 80 + 40 * 40 + 20 * 20);
+    arena.reset();
+    float* boxes = arena.alloc<float>(max_num_proposals * 4);
+    float* scores = arena.alloc<float>(max_num_proposals);
+    int* labels = arena.alloc<int>(max_num_proposals);
+
+    int num_proposals = 0;
+    for (int i = 0; i < 3; ++i) {
+        num_proposals += generate_proposals(anchors[i], num_grids[i], num_grids[i], 8 << i, heads[i].data(), 0.25f, 80,
+                                            boxes + num_proposals * 4, scores + num_proposals, labels + num_proposals);
+    }
+
+    return select_detections(boxes, scores, labels, num_proposals, 30000, 0.45f, false, 300, info, &arena,
+                             &detections);
+}
+
+int main(int argc, char* argv[]){
+    const int width = 1280, height = 720;
+    const float densities[] = {0.05f, 0.001f, 0.01f, 0.02f};
+    const int num_frames = 16;
+
+    std::mt19937 rng(16);
+    std::vector<uint8_t> image(width * height * 3);
+    for (uint8_t& v : image)
+        v = rng() & 0xff;
+
+    // a few head sets of different density, the densest first
+    const int num_grids[3] = {80, 40, 20};
+    std::vector<std::vector<float>> heads(4 * 3);
+    for (int d = 0; d < 4; ++d) {
+        for (int i = 0; i < 3; ++i) {
+            heads[d * 3 + i].resize(3 * num_grids[i] * num_grids[i] * 85);
+            fill_head(densities[d], rng, heads[d * 3 + i]);
+        }
+    }
+
+    ScratchArena arena;
+    std::vector<float> input(3 * 640 * 640);
+    Detections detections;
+
+    // the first frame at the largest size grows the arena, for good with the next reset
+    int num_keep = detect_frame(image, width, height, &heads[0], arena, input, detections);
+    arena.reset();
+    const size_t capacity = arena.get_capacity();
+
+    const uint64_t before = num_allocations.load();
+    for (int f = 0; f < num_frames; ++f) {
+        num_keep += detect_frame(image, width, height, &heads[(f % 4) * 3], arena, input, detections);
+    }
+    const uint64_t allocations = num_allocations.load() - before;
+
+    printf("%d frames, %d detections, arena %zu bytes, %lu heap allocations\n", num_frames, num_keep, capacity,
+           (unsigned long)allocations);
+
+    if (allocations != 0 || arena.get_capacity() != capacity) {
+        fprintf(stderr, "the steady state detect path allocated %lu times\n", (unsigned long)allocations);
+        return 1;
+    }
+
+    return 0;
+}
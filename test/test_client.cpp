@@ -0,0 +1,106 @@
+#include "stats.h"
+#include "yolov5_client.h"
+
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
+
+#include <opencv2/opencv.hpp>
+
+// ./test_client /tmp/yolov5.sock image.jpg [--requests N] [--inflight S] [--budget-ms D]
+int main(int argc, char* argv[]){
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s socket image [--requests N] [--inflight S] [--budget-ms D]\n", argv[0]);
+        return 1;
+    }
+
+    int num_requests = 100;
+    int num_inflight = 4;
+    int64_t budget_us = 0;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--requests") == 0)
+            num_requests = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--inflight") == 0)
+            num_inflight = std::max(atoi(argv[i + 1]), 1);
+        else if (strcmp(argv[i], "--budget-ms") == 0)
+            budget_us = atoi(argv[i + 1]) * 1000;
+    }
+
+    cv::Mat image = cv::imread(argv[2]);
+    if (image.empty()) {
+        fprintf(stderr, "cannot decode %s\n", argv[2]);
+        return 1;
+    }
+
+    // every slot holds one frame, a real client decodes straight into them
+    const int stride = image.cols * 3;
+    Yolov5Client client;
+    if (client.connect(argv[1], num_inflight, (uint64_t)stride * image.rows) != ppl::common::RC_SUCCESS)
+        return 1;
+    for (uint32_t slot = 0; slot < client.get_num_slots(); ++slot) {
+        for (int y = 0; y < image.rows; ++y)
+            memcpy(client.get_slot(slot) + y * stride, image.ptr<uint8_t>(y), stride);
+    }
+
+    // responses come back out of order, a slot is free again only once its own request is answered, and the
+    // latency of a request is measured from its own submit
+    struct InflightRequest{
+        uint32_t slot;
+        int64_t submit_ns;
+    };
+    std::vector<uint32_t> free_slots;
+    for (uint32_t slot = client.get_num_slots(); slot > 0; --slot)
+        free_slots.push_back(slot - 1);
+    std::unordered_map<uint64_t, InflightRequest> inflight;
+
+    LatencyHistogram latency, queue;
+    uint64_t status_counts[IPC_FAILED + 1] = {0};
+    uint64_t num_detections = 0;
+    IpcResponse response;
+    std::vector<IpcDetection> detections;
+
+    const int64_t start_ns = ipc_now_ns();
+    int submitted = 0, received = 0;
+    while (received < num_requests) {
+        while (submitted < num_requests && !free_slots.empty()) {
+            InflightRequest request;
+            request.slot = free_slots.back();
+            request.submit_ns = ipc_now_ns();
+            if (client.submit(request.slot, submitted, image.cols, image.rows, stride, budget_us) !=
+                ppl::common::RC_SUCCESS)
+                return 1;
+            free_slots.pop_back();
+            inflight[submitted] = request;
+            ++submitted;
+        }
+
+        if (client.receive(&response, &detections) != ppl::common::RC_SUCCESS)
+            return 1;
+        ++received;
+
+        auto it = inflight.find(response.request_id);
+        if (it == inflight.end()) {
+            fprintf(stderr, "response to unknown request %lu\n", (unsigned long)response.request_id);
+            return 1;
+        }
+        latency.record(ipc_now_ns() - it->second.submit_ns);
+        free_slots.push_back(it->second.slot);
+        inflight.erase(it);
+
+        queue.record(response.queue_ns);
+        status_counts[std::min<uint32_t>(response.status, IPC_FAILED)]++;
+        num_detections += detections.size();
+    }
+    const double seconds = (ipc_now_ns() - start_ns) * 1e-9;
+
+    printf("%d requests in %.2f s: %.1f requests/s, %.2f detections/request\n", num_requests, seconds,
+           num_requests / seconds, (double)num_detections / num_requests);
+    printf("ok %lu expired %lu overloaded %lu invalid %lu failed %lu\n", (unsigned long)status_counts[IPC_OK],
+           (unsigned long)status_counts[IPC_EXPIRED], (unsigned long)status_counts[IPC_OVERLOADED],
+           (unsigned long)status_counts[IPC_INVALID], (unsigned long)status_counts[IPC_FAILED]);
+    printf("latency us p50 %.1f p99 %.1f max %.1f, server queue us p50 %.1f p99 %.1f\n",
+           latency.percentile_us(50), latency.percentile_us(99), latency.max_us(), queue.percentile_us(50),
+           queue.percentile_us(99));
+
+    return 0;
+}
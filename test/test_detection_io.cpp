@@ -0,0 +1,105 @@
+#include "detection_io.h"
+
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void random_frame(std::mt19937& rng, Detections& detections) {
+    std::uniform_real_distribution<float> coordinate(0.f, 1920.f);
+    std::uniform_real_distribution<float> score(0.25f, 1.f);
+
+    detections.clear();
+    const int count = rng() % 40;
+    for (int i = 0; i < count; ++i) {
+        float box[4] = {coordinate(rng), coordinate(rng), coordinate(rng), coordinate(rng)};
+        detections.push_back(box, score(rng), rng() % 80);
+    }
+}
+
+static bool same(const DetectionFrameView& view, const uint64_t frame_id, const Detections& detections) {
+    const size_t bytes = view.count * sizeof(float);
+    return view.frame_id == frame_id && view.count == detections.size() &&
+           (view.count == 0 ||
+            (memcmp(view.x1, detections.x1.data(), bytes) == 0 && memcmp(view.y1, detections.y1.data(), bytes) == 0 &&
+             memcmp(view.x2, detections.x2.data(), bytes) == 0 && memcmp(view.y2, detections.y2.data(), bytes) == 0 &&
+             memcmp(view.score, detections.score.data(), bytes) == 0 &&
+             memcmp(view.label, detections.label.data(), view.count * sizeof(int32_t)) == 0));
+}
+
+int main(int argc, char* argv[]){
+    char path[] = "/tmp/test_detection_io_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    const int num_frames = 1000;
+    std::mt19937 rng(17);
+    std::vector<Detections> frames(num_frames);
+    for (Detections& frame : frames)
+        random_frame(rng, frame);
+
+    // two writer sessions, the second one appends
+    int failures = 0;
+    for (int session = 0; session < 2; ++session) {
+        DetectionWriter writer;
+        if (writer.open(path, session == 1) != ppl::common::RC_SUCCESS)
+            return 1;
+        for (int f = session * num_frames / 2; f < (session + 1) * num_frames / 2; ++f) {
+            if (writer.write_frame(f, frames[f]) != ppl::common::RC_SUCCESS)
+                ++failures;
+        }
+    }
+
+    // a record cut short by a crashed writer
+    FILE* fp = fopen(path, "ab");
+    const uint32_t partial[2] = {4000, 7};
+    fwrite(partial, sizeof(partial), 1, fp);
+    fclose(fp);
+
+    DetectionReader reader;
+    if (reader.open(path) != ppl::common::RC_SUCCESS)
+        return 1;
+
+    DetectionFrameView view;
+    int num_read = 0;
+    while (reader.next(&view)) {
+        if (num_read >= num_frames || !same(view, num_read, frames[num_read]))
+            ++failures;
+        ++num_read;
+    }
+    if (num_read != num_frames)
+        ++failures;
+
+    reader.rewind();
+    if (!reader.next(&view) || !same(view, 0, frames[0]))
+        ++failures;
+    reader.close();
+
+    // a third session cuts the torn record off, its frame follows the last complete one
+    Detections last;
+    random_frame(rng, last);
+    {
+        DetectionWriter writer;
+        if (writer.open(path, true) != ppl::common::RC_SUCCESS ||
+            writer.write_frame(num_frames, last) != ppl::common::RC_SUCCESS)
+            ++failures;
+    }
+    if (reader.open(path) != ppl::common::RC_SUCCESS)
+        return 1;
+    int num_appended = 0;
+    while (reader.next(&view)) {
+        if (num_appended == num_frames && !same(view, num_frames, last))
+            ++failures;
+        ++num_appended;
+    }
+    if (num_appended != num_frames + 1)
+        ++failures;
+
+    reader.close();
+    unlink(path);
+
+    printf("%d frames written, %d read back, %d failures\n", num_frames, num_read, failures);
+    return failures ? 1 : 0;
+}
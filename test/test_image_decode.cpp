@@ -0,0 +1,113 @@
+#include "image_decode.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// a gradient, so that the encoder has something to compress
+static std::vector<uint8_t> encode_jpeg(const int width, const int height) {
+    cv::Mat image(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = image.ptr<uint8_t>(y);
+        for (int x = 0; x < width; ++x) {
+            row[x * 3 + 0] = x & 0xff;
+            row[x * 3 + 1] = y & 0xff;
+            row[x * 3 + 2] = (x + y) & 0xff;
+        }
+    }
+
+    std::vector<uint8_t> jpeg;
+    cv::imencode(".jpg", image, jpeg);
+    return jpeg;
+}
+
+// an APP1 segment right after SOI whose EXIF orientation is 6, rotate 90 degrees clockwise to display
+static std::vector<uint8_t> add_exif_orientation(const std::vector<uint8_t>& jpeg) {
+    static const uint8_t app1[] = {
+        0xFF, 0xE1, 0x00, 0x22,                         // APP1, 34 bytes after the marker
+        'E', 'x', 'i', 'f', 0x00, 0x00,
+        'M', 'M', 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08,   // big endian TIFF header, IFD0 at 8
+        0x00, 0x01,                                     // one entry
+        0x01, 0x12, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, // orientation, SHORT, count 1
+        0x00, 0x06, 0x00, 0x00,                         // value 6
+        0x00, 0x00, 0x00, 0x00,                         // no next IFD
+    };
+
+    std::vector<uint8_t> result(jpeg.begin(), jpeg.begin() + 2);
+    result.insert(result.end(), app1, app1 + sizeof(app1));
+    result.insert(result.end(), jpeg.begin() + 2, jpeg.end());
+    return result;
+}
+
+// the decoded image scaled back must cover the full size one to within a pixel per scaling step
+static bool scales_back(const cv::Mat& image, const float scale_x, const float scale_y, const int width,
+                        const int height, const int denom) {
+    return fabsf(image.cols * scale_x - width) < denom && fabsf(image.rows * scale_y - height) < denom;
+}
+
+int main(int argc, char* argv[]){
+    int failures = 0;
+
+    // scalings for a 640x640 input, the letterbox of 1920x1080 is 640x360, so 960x540 is the smallest to cover it;
+    // libjpeg rounds scaled sizes up, 1279 / 2 still covers 640 and 1278 / 2 does not
+    const int denom_cases[][5] = {{1920, 1080, 640, 640, 2}, {4000, 3000, 640, 640, 4}, {6000, 4000, 640, 640, 8},
+                                  {640, 640, 640, 640, 1},   {333, 517, 640, 640, 1},   {1280, 1280, 640, 640, 2},
+                                  {1279, 1279, 640, 640, 2}, {1278, 1278, 640, 640, 1}, {0, 480, 640, 640, 1}};
+    for (const int* c : denom_cases) {
+        const int denom = choose_jpeg_scale_denom(c[0], c[1], c[2], c[3]);
+        if (denom != c[4]) {
+            fprintf(stderr, "choose_jpeg_scale_denom(%d, %d, %d, %d) = %d, expected %d\n", c[0], c[1], c[2], c[3],
+                    denom, c[4]);
+            ++failures;
+        }
+    }
+
+    // sizes read from the frame header, and the decode at the scale chosen for them
+    const int sizes[][3] = {{1920, 1080, 2}, {2600, 1950, 4}, {640, 640, 1}, {333, 517, 1}};
+    for (const int* size : sizes) {
+        const std::vector<uint8_t> jpeg = encode_jpeg(size[0], size[1]);
+        int width = 0, height = 0;
+        if (!read_jpeg_size(jpeg.data(), jpeg.size(), &width, &height) || width != size[0] || height != size[1]) {
+            fprintf(stderr, "read_jpeg_size of %dx%d returned %dx%d\n", size[0], size[1], width, height);
+            ++failures;
+        }
+
+        cv::Mat image;
+        float scale_x = 0.f, scale_y = 0.f;
+        const int denom = size[2];
+        if (decode_image(jpeg.data(), jpeg.size(), 640, 640, &image, &scale_x, &scale_y) != ppl::common::RC_SUCCESS ||
+            image.cols != (size[0] + denom - 1) / denom || image.rows != (size[1] + denom - 1) / denom ||
+            !scales_back(image, scale_x, scale_y, size[0], size[1], denom)) {
+            fprintf(stderr, "decode_image of %dx%d: %dx%d, scales %g %g\n", size[0], size[1], image.cols, image.rows,
+                    scale_x, scale_y);
+            ++failures;
+        }
+    }
+
+    // not a JPEG, or cut off before its frame header
+    std::vector<uint8_t> png;
+    cv::imencode(".png", cv::Mat(8, 8, CV_8UC3, cv::Scalar(0, 0, 0)), png);
+    const std::vector<uint8_t> jpeg = encode_jpeg(1920, 1080);
+    int width = 0, height = 0;
+    if (read_jpeg_size(png.data(), png.size(), &width, &height) || read_jpeg_size(jpeg.data(), 4, &width, &height) ||
+        read_jpeg_size(NULL, 0, &width, &height)) {
+        fprintf(stderr, "read_jpeg_size accepted data without a frame header\n");
+        ++failures;
+    }
+
+    // EXIF orientation 6 turns the decoded 1920x1080 frame upright, the scales follow the swapped axes
+    const std::vector<uint8_t> rotated = add_exif_orientation(jpeg);
+    cv::Mat image;
+    float scale_x = 0.f, scale_y = 0.f;
+    if (!read_jpeg_size(rotated.data(), rotated.size(), &width, &height) || width != 1920 || height != 1080 ||
+        decode_image(rotated.data(), rotated.size(), 640, 640, &image, &scale_x, &scale_y) != ppl::common::RC_SUCCESS ||
+        image.cols != 540 || image.rows != 960 || !scales_back(image, scale_x, scale_y, 1080, 1920, 2)) {
+        fprintf(stderr, "decode_image of a rotated 1920x1080: %dx%d, scales %g %g\n", image.cols, image.rows, scale_x,
+                scale_y);
+        ++failures;
+    }
+
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "cpu_isa.h"
+#include "mmcv_nms.h"
+#include "preprocess.h"
+#include "utils.h"
+
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// everything one variant writes, compared byte for byte with the scalar one
+struct KernelOutputs{
+    std::vector<float> proposals;
+    std::vector<int> labels;
+    std::vector<int64_t> keep;
+    std::vector<float> planes;
+};
+
+// raw head cells, some pass the threshold and some of those have tied class scores
+static void fill_head(const int num_cells, const int num_classes, std::mt19937& rng, std::vector<float>& head) {
+    std::uniform_real_distribution<float> uniform(-4.f, 4.f);
+    head.resize(num_cells * (num_classes + 5));
+    for (int cell = 0; cell < num_cells; ++cell) {
+        float* p = head.data() + cell * (num_classes + 5);
+        for (int k = 0; k < num_classes + 5; ++k)
+            p[k] = uniform(rng);
+        if (rng() % 4 == 0)
+            p[5 + rng() % num_classes] = p[5 + rng() % num_classes] = 5.f;
+    }
+}
+
+// in-graph decoded rows, probabilities instead of logits
+static void fill_fused(const int num_boxes, const int num_classes, std::mt19937& rng, std::vector<float>& output) {
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    output.resize(num_boxes * (num_classes + 5));
+    for (int i = 0; i < num_boxes; ++i) {
+        float* row = output.data() + i * (num_classes + 5);
+        row[0] = uniform(rng) * 640.f;
+        row[1] = uniform(rng) * 640.f;
+        row[2] = uniform(rng) * 100.f;
+        row[3] = uniform(rng) * 100.f;
+        row[4] = uniform(rng);
+        for (int k = 0; k < num_classes; ++k)
+            row[5 + k] = uniform(rng);
+    }
+}
+
+static void fill_boxes(const uint32_t num_boxes, std::mt19937& rng, std::vector<float>& boxes,
+                       std::vector<float>& scores) {
+    std::uniform_real_distribution<float> center(0.f, 640.f);
+    std::uniform_real_distribution<float> size(8.f, 160.f);
+    std::uniform_int_distribution<int> score(0, 100);
+    boxes.resize(num_boxes * 4);
+    scores.resize(num_boxes);
+    for (uint32_t i = 0; i < num_boxes; ++i) {
+        // few centers, so that many boxes overlap
+        const float cx = center(rng) / 64.f * 8.f;
+        const float cy = center(rng) / 64.f * 8.f;
+        const float w = size(rng);
+        const float h = size(rng);
+        boxes[i * 4 + 0] = cx - w * 0.5f;
+        boxes[i * 4 + 1] = cy - h * 0.5f;
+        boxes[i * 4 + 2] = cx + w * 0.5f;
+        boxes[i * 4 + 3] = cy + h * 0.5f;
+        scores[i] = score(rng) / 100.f;
+    }
+}
+
+static void run_kernels(const unsigned int seed, KernelOutputs& outputs) {
+    std::mt19937 rng(seed);
+    const std::vector<float> anchor = {10.f, 13.f, 16.f, 30.f, 33.f, 23.f};
+
+    // class counts around every vector width, grids whose size is no multiple of any of them
+    const int class_counts[] = {1, 7, 15, 16, 33, 80};
+    for (int num_classes : class_counts) {
+        std::vector<float> head;
+        fill_head(3 * 37 * 29, num_classes, rng, head);
+        std::vector<float> boxes(3 * 37 * 29 * 4), scores(3 * 37 * 29);
+        std::vector<int> labels(3 * 37 * 29);
+        int n = generate_proposals(anchor, 37, 29, 8, head.data(), 0.25f, num_classes, boxes.data(), scores.data(),
+                                   labels.data());
+        outputs.proposals.insert(outputs.proposals.end(), boxes.begin(), boxes.begin() + n * 4);
+        outputs.proposals.insert(outputs.proposals.end(), scores.begin(), scores.begin() + n);
+        outputs.labels.insert(outputs.labels.end(), labels.begin(), labels.begin() + n);
+
+        std::vector<float> fused;
+        fill_fused(1003, num_classes, rng, fused);
+        n = decode_fused_output(fused.data(), 1003, num_classes, 0.25f, boxes.data(), scores.data(), labels.data());
+        outputs.proposals.insert(outputs.proposals.end(), boxes.begin(), boxes.begin() + n * 4);
+        outputs.proposals.insert(outputs.proposals.end(), scores.begin(), scores.begin() + n);
+        outputs.labels.insert(outputs.labels.end(), labels.begin(), labels.begin() + n);
+    }
+
+    const uint32_t box_counts[] = {0, 1, 5, 17, 250, 1001};
+    const float iou_thresholds[] = {0.f, 0.45f, 0.7f};
+    for (uint32_t num_boxes : box_counts) {
+        for (float iou_threshold : iou_thresholds) {
+            std::vector<float> boxes, scores;
+            fill_boxes(num_boxes, rng, boxes, scores);
+            std::vector<int64_t> keep(num_boxes);
+            int64_t num_keep = 0;
+            mmcv_nms_ndarray_fp32(boxes.data(), scores.data(), num_boxes, iou_threshold, 0, keep.data(), &num_keep);
+            outputs.keep.insert(outputs.keep.end(), keep.begin(), keep.begin() + num_keep);
+            outputs.keep.push_back(-1);
+        }
+    }
+
+    // downscaled, upscaled and odd sizes, plus a row step wider than the pixels
+    const int sizes[][3] = {{1280, 720, 1280 * 3}, {333, 517, 333 * 3 + 7}, {17, 9, 17 * 3}, {640, 640, 640 * 3}};
+    const float mean[3] = {0.485f * 255.f, 0.456f * 255.f, 0.406f * 255.f};
+    const float std[3] = {0.229f * 255.f, 0.224f * 255.f, 0.225f * 255.f};
+    for (const int* size : sizes) {
+        std::vector<uint8_t> image(size[2] * size[1]);
+        for (uint8_t& v : image)
+            v = rng() & 0xff;
+
+        std::vector<float> planes(3 * 640 * 640);
+        LetterboxInfo info;
+        letterbox_bgr_to_planar(image.data(), size[0], size[1], size[2], 640, 640, mean, std, planes.data(), &info,
+                                NULL);
+        outputs.planes.insert(outputs.planes.end(), planes.begin(), planes.end());
+    }
+}
+
+template <typename T>
+static bool same_bytes(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+int main(int argc, char* argv[]){
+    const CpuIsa host_isa = get_host_cpu_isa();
+    printf("host %s\n", get_cpu_isa_name(host_isa));
+
+    KernelOutputs reference;
+    set_cpu_isa(CPU_ISA_SCALAR);
+    run_kernels(2021, reference);
+    printf("scalar: %zu proposal floats, %zu kept indices, %zu plane floats\n", reference.proposals.size(),
+           reference.keep.size(), reference.planes.size());
+
+    int failures = 0;
+    for (int i = CPU_ISA_SSE2; i <= CPU_ISA_AVX512; ++i) {
+        const CpuIsa isa = static_cast<CpuIsa>(i);
+        if (isa > host_isa) {
+            printf("%s: not supported by this host, skipped\n", get_cpu_isa_name(isa));
+            continue;
+        }
+
+        set_cpu_isa(isa);
+        KernelOutputs outputs;
+        run_kernels(2021, outputs);
+
+        const bool proposals = same_bytes(outputs.proposals, reference.proposals) &&
+                               same_bytes(outputs.labels, reference.labels);
+        const bool nms = same_bytes(outputs.keep, reference.keep);
+        const bool preprocess = same_bytes(outputs.planes, reference.planes);
+        printf("%s: proposals %s nms %s preprocess %s\n", get_cpu_isa_name(isa), proposals ? "ok" : "MISMATCH",
+               nms ? "ok" : "MISMATCH", preprocess ? "ok" : "MISMATCH");
+        if (!proposals || !nms || !preprocess)
+            ++failures;
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d instruction set(s) differ from the scalar kernels\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
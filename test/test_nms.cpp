@@ -0,0 +1,92 @@
+#include "mmcv_nms.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+typedef ppl::common::RetCode (*NmsFunc)(const float*, const float*, const uint32_t, const float,
+                                        const int64_t, int64_t*, int64_t*);
+
+// clustered boxes like the proposals of a crowded frame, with some duplicated scores
+static void generate_boxes(const uint32_t num_boxes, const uint32_t num_clusters, std::mt19937& rng,
+                           std::vector<float>& boxes, std::vector<float>& scores) {
+    std::uniform_real_distribution<float> center(0.f, 640.f);
+    std::uniform_real_distribution<float> size(8.f, 160.f);
+    std::normal_distribution<float> jitter(0.f, 6.f);
+    std::uniform_int_distribution<int> score(0, 1000);
+
+    std::vector<float> clusters(num_clusters * 4);
+    for (uint32_t c = 0; c < num_clusters; ++c) {
+        clusters[c * 4 + 0] = center(rng);
+        clusters[c * 4 + 1] = center(rng);
+        clusters[c * 4 + 2] = size(rng);
+        clusters[c * 4 + 3] = size(rng);
+    }
+
+    boxes.resize(num_boxes * 4);
+    scores.resize(num_boxes);
+    for (uint32_t i = 0; i < num_boxes; ++i) {
+        const float* cluster = clusters.data() + (rng() % num_clusters) * 4;
+        float cx = cluster[0] + jitter(rng);
+        float cy = cluster[1] + jitter(rng);
+        float w = cluster[2] + jitter(rng);
+        float h = cluster[3] + jitter(rng);
+        boxes[i * 4 + 0] = cx - w * 0.5f;
+        boxes[i * 4 + 1] = cy - h * 0.5f;
+        boxes[i * 4 + 2] = cx + w * 0.5f;
+        boxes[i * 4 + 3] = cy + h * 0.5f;
+        scores[i] = score(rng) / 1000.f;
+    }
+}
+
+static double run_nms(NmsFunc func, const std::vector<float>& boxes, const std::vector<float>& scores,
+                      const float iou_threshold, const int64_t offset, std::vector<int64_t>& keep) {
+    const uint32_t num_boxes = scores.size();
+    keep.resize(num_boxes);
+    int64_t num_keep = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    func(boxes.data(), scores.data(), num_boxes, iou_threshold, offset, keep.data(), &num_keep);
+    auto end = std::chrono::steady_clock::now();
+
+    keep.resize(num_keep);
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+int main(int argc, char* argv[]){
+    const uint32_t num_boxes_list[] = {0, 1, 3, 17, 250, 1000, 4000};
+    const float iou_thresholds[] = {0.f, 0.45f, 0.7f};
+    const int64_t offsets[] = {0, 1};
+
+    std::mt19937 rng(2021);
+    int failures = 0;
+
+    for (uint32_t num_boxes : num_boxes_list) {
+        for (float iou_threshold : iou_thresholds) {
+            for (int64_t offset : offsets) {
+                std::vector<float> boxes, scores;
+                generate_boxes(num_boxes, num_boxes / 20 + 1, rng, boxes, scores);
+
+                std::vector<int64_t> keep_naive, keep_soa;
+                double naive_us   = run_nms(mmcv_nms_ndarray_fp32_naive, boxes, scores, iou_threshold, offset, keep_naive);
+                double soa_us     = run_nms(mmcv_nms_ndarray_fp32_soa, boxes, scores, iou_threshold, offset, keep_soa);
+
+                bool match = (keep_soa == keep_naive);
+                if (!match)
+                    ++failures;
+
+                printf("boxes %5u iou %.2f offset %ld keep %5zu | naive %10.1f us soa %10.1f us %s\n",
+                       num_boxes, iou_threshold, (long)offset, keep_naive.size(), naive_us, soa_us,
+                       match ? "" : "MISMATCH");
+            }
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d nms configurations differ from the naive kernel\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "result_cache.h"
+
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                      \
+        }                                                                  \
+    } while (0)
+
+static Detections make_detections(const int count, const float score) {
+    Detections detections;
+    for (int i = 0; i < count; ++i) {
+        const float box[4] = {(float)i, (float)i, i + 10.f, i + 10.f};
+        detections.push_back(box, score, i % 80);
+    }
+    return detections;
+}
+
+int main(int argc, char* argv[]){
+    // the hash depends on every byte and on the seed
+    std::vector<uint8_t> bytes(1000);
+    for (size_t i = 0; i < bytes.size(); ++i)
+        bytes[i] = i * 7;
+    const uint64_t h = ResultCache::hash_bytes(bytes.data(), bytes.size(), 0);
+    CHECK(h == ResultCache::hash_bytes(bytes.data(), bytes.size(), 0));
+    CHECK(h != ResultCache::hash_bytes(bytes.data(), bytes.size(), 1));
+    CHECK(h != ResultCache::hash_bytes(bytes.data(), bytes.size() - 1, 0));
+    bytes[999] ^= 1;
+    CHECK(h != ResultCache::hash_bytes(bytes.data(), bytes.size(), 0));
+
+    // a single shard so the LRU order is easy to follow
+    ResultCache cache(4096, 1);
+    Detections result;
+    CHECK(!cache.lookup(1, &result));
+    cache.insert(1, make_detections(10, 0.5f));
+    CHECK(cache.lookup(1, &result));
+    CHECK(result.size() == 10 && result.score[0] == 0.5f && result.x2[3] == 13.f);
+
+    // fill past the cap while key 1 stays in use, the others go least recently used first
+    for (uint64_t key = 2; key < 40; ++key) {
+        cache.insert(key, make_detections(10, key * 0.01f));
+        CHECK(cache.lookup(1, &result));
+    }
+    ResultCacheCounters counters = cache.get_counters();
+    CHECK(counters.bytes <= 4096);
+    CHECK(counters.evictions > 0);
+    CHECK(counters.entries + counters.evictions == counters.insertions);
+    CHECK(cache.lookup(39, &result) && result.score[0] == 0.39f);
+    CHECK(!cache.lookup(2, &result));
+
+    // a result larger than a shard is not cached at all
+    cache.insert(100, make_detections(1000, 1.f));
+    CHECK(!cache.lookup(100, &result));
+
+    // concurrent callers on all shards
+    ResultCache shared(1 << 20);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared, t]() {
+            Detections found;
+            for (uint64_t i = 0; i < 20000; ++i) {
+                const uint64_t key = ResultCache::hash_bytes(&i, sizeof(i), t % 2);
+                if (!shared.lookup(key, &found))
+                    shared.insert(key, make_detections(i % 8, 0.25f));
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    counters = shared.get_counters();
+    printf("hits %lu misses %lu insertions %lu evictions %lu entries %lu bytes %lu\n", (unsigned long)counters.hits,
+           (unsigned long)counters.misses, (unsigned long)counters.insertions, (unsigned long)counters.evictions,
+           (unsigned long)counters.entries, (unsigned long)counters.bytes);
+    CHECK(counters.hits + counters.misses == 4 * 20000);
+    CHECK(counters.bytes <= (1 << 20));
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "yolov5_server.h"
+
+#include <memory>
+#include <signal.h>
+#include <string.h>
+
+// ./test_server model.onnx /tmp/yolov5.sock [--max-batch B] [--max-wait-us W] [--budget-ms D] [--runtimes R]
+int main(int argc, char* argv[]){
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model.onnx socket [--max-batch B] [--max-wait-us W] [--budget-ms D] "
+                        "[--runtimes R]\n", argv[0]);
+        return 1;
+    }
+
+    ServerParams server_params;
+    server_params.socket_path       = argv[2];
+    server_params.max_batch         = 4;
+    server_params.max_wait_us       = 2000;
+    server_params.default_budget_us = 0;
+    server_params.max_queue         = 256;
+    server_params.num_batchers      = 2;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--max-batch") == 0)
+            server_params.max_batch = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--max-wait-us") == 0)
+            server_params.max_wait_us = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--budget-ms") == 0)
+            server_params.default_budget_us = atoi(argv[i + 1]) * 1000;
+        else if (strcmp(argv[i], "--runtimes") == 0)
+            server_params.num_batchers = atoi(argv[i + 1]);
+    }
+
+    ModelParams yolov5_params;
+    yolov5_params.onnx_path      = argv[1];
+    yolov5_params.num_runtimes   = server_params.num_batchers; // one batch in flight per runtime
+    yolov5_params.class_agnostic = false;
+    yolov5_params.pre_nms_topk   = 30000;
+    yolov5_params.max_det        = 300;
+    yolov5_params.dynamic_shape  = false;                      // batches of any mix of sizes share one shape
+
+    std::unique_ptr<Yolov5Impl> yolov5(new Yolov5Impl(yolov5_params));
+    if (yolov5->yolov5_network_detect_init() != ppl::common::RC_SUCCESS)
+        return 1;
+
+    // the threads started below inherit the mask, so only sigwait sees the signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    Yolov5Server server(yolov5.get(), server_params);
+    if (server.start() != ppl::common::RC_SUCCESS)
+        return 1;
+    printf("serving on %s, max batch %d, max wait %ld us\n", server_params.socket_path, server_params.max_batch,
+           (long)server_params.max_wait_us);
+
+    int signal_number = 0;
+    sigwait(&signals, &signal_number);
+    server.stop();
+
+    ServerCounters counters = server.get_counters();
+    printf("connections %lu requests %lu completed %lu batches %lu (%.2f images/batch) expired %lu overloaded %lu "
+           "invalid %lu failed %lu\n",
+           (unsigned long)counters.connections, (unsigned long)counters.requests, (unsigned long)counters.completed,
+           (unsigned long)counters.batches,
+           counters.batches ? (double)(counters.completed + counters.failed) / counters.batches : 0.0,
+           (unsigned long)counters.expired, (unsigned long)counters.overloaded, (unsigned long)counters.invalid,
+           (unsigned long)counters.failed);
+    yolov5->get_stats().print(stdout);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "yolov5_stream.h"
+
+#include <memory>
+#include <string.h>
+
+#include <opencv2/opencv.hpp>
+
+// ./test_stream model.onnx video.mp4 [oldest|newest|block] [latency budget ms]
+int main(int argc, char* argv[]){
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model.onnx video [oldest|newest|block] [budget_ms]\n", argv[0]);
+        return 1;
+    }
+
+    ModelParams yolov5_params;
+    yolov5_params.onnx_path      = argv[1];
+    yolov5_params.prob_threshold = 0.5;
+    yolov5_params.num_runtimes   = 2;
+    yolov5_params.dynamic_shape  = true;
+    yolov5_params.class_agnostic = false;
+    yolov5_params.pre_nms_topk   = 30000;
+    yolov5_params.max_det        = 300;
+
+    std::unique_ptr<Yolov5Impl> yolov5(new Yolov5Impl(yolov5_params));
+    if (yolov5->yolov5_network_detect_init() != ppl::common::RC_SUCCESS)
+        return 1;
+
+    StreamParams stream_params;
+    stream_params.capacity          = 2;
+    stream_params.drop_policy       = STREAM_DROP_OLDEST;
+    stream_params.num_workers       = yolov5_params.num_runtimes;
+    stream_params.realtime          = true;
+    stream_params.latency_budget_us = argc > 4 ? atoi(argv[4]) * 1000 : 0;
+    if (argc > 3 && strcmp(argv[3], "newest") == 0)
+        stream_params.drop_policy = STREAM_DROP_NEWEST;
+    else if (argc > 3 && strcmp(argv[3], "block") == 0)
+        stream_params.drop_policy = STREAM_BLOCK;
+
+    Yolov5Stream stream(yolov5.get(), stream_params, [](StreamResult& result) {
+        printf("frame %6ld t %9.1f ms boxes %3zu queue %8.1f us latency %8.1f us dropped %lu\n",
+               (long)result.frame_index, result.stream_time_ms, result.detect_res.size(),
+               result.queue_us, result.latency_us, (unsigned long)result.dropped);
+    });
+
+    if (stream.start(argv[2]) != ppl::common::RC_SUCCESS)
+        return 1;
+    stream.wait();
+
+    StreamCounters counters = stream.get_counters();
+    printf("decoded %lu processed %lu dropped full %lu dropped stale %lu failed %lu\n",
+           (unsigned long)counters.decoded, (unsigned long)counters.processed,
+           (unsigned long)counters.dropped_full, (unsigned long)counters.dropped_stale,
+           (unsigned long)counters.failed);
+    yolov5->get_stats().print(stdout);
+
+    return 0;
+}
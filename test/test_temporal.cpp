@@ -0,0 +1,57 @@
+#include "yolov5_temporal.h"
+
+#include <memory>
+#include <string.h>
+
+#include <opencv2/opencv.hpp>
+
+// ./test_temporal model.onnx video.mp4 [cell threshold] [keyframe interval]
+int main(int argc, char* argv[]){
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model.onnx video [cell_threshold] [keyframe_interval]\n", argv[0]);
+        return 1;
+    }
+
+    ModelParams yolov5_params;
+    yolov5_params.onnx_path      = argv[1];
+    yolov5_params.prob_threshold = 0.5;
+    yolov5_params.dynamic_shape  = true;
+    yolov5_params.class_agnostic = false;
+    yolov5_params.pre_nms_topk   = 30000;
+    yolov5_params.max_det        = 300;
+
+    std::unique_ptr<Yolov5Impl> yolov5(new Yolov5Impl(yolov5_params));
+    if (yolov5->yolov5_network_detect_init() != ppl::common::RC_SUCCESS)
+        return 1;
+
+    TemporalParams temporal_params;
+    temporal_params.grid_width        = 32;
+    temporal_params.grid_height       = 18;
+    temporal_params.cell_threshold    = argc > 3 ? atof(argv[3]) : 6.f;
+    temporal_params.max_changed_cells = 0;
+    temporal_params.keyframe_interval = argc > 4 ? atoi(argv[4]) : 30;
+    Yolov5Temporal temporal(yolov5.get(), temporal_params);
+
+    cv::VideoCapture capture;
+    if (!capture.open(argv[2])) {
+        fprintf(stderr, "cannot open video source %s\n", argv[2]);
+        return 1;
+    }
+
+    cv::Mat frame;
+    std::vector<DetectRes> detect_res;
+    for (int64_t index = 0; capture.read(frame); ++index) {
+        bool skipped = false;
+        detect_res.clear();
+        if (temporal.detect(frame, detect_res, &skipped) != ppl::common::RC_SUCCESS)
+            return 1;
+        printf("frame %6ld boxes %3zu %s\n", (long)index, detect_res.size(), skipped ? "reused" : "inferred");
+    }
+
+    TemporalCounters counters = temporal.get_counters();
+    printf("frames %lu inferred %lu skipped %lu skip ratio %.3f\n", (unsigned long)counters.frames,
+           (unsigned long)counters.inferred, (unsigned long)counters.skipped, counters.get_skip_ratio());
+    yolov5->get_stats().print(stdout);
+
+    return 0;
+}
@@ -0,0 +1,325 @@
+#include "detection_io.h"
+#include "stats.h"
+#include "yolov5.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+// ./test_throughput model.onnx <image dir | list file> [--readers R] [--workers K] [--instances]
+//                   [--threads T] [--repeat N] [--detections out.ydet] [--encoded]
+//                   [--cache-mb M]
+struct DriverOptions{
+    const char* model_path;
+    const char* input_path;
+    int num_readers;         ///< threads decoding images
+    int num_workers;         ///< threads calling detect, one runtime each
+    bool instances;          ///< one Yolov5Impl per worker instead of one shared pool of runtimes
+    int num_threads;         ///< intra-op threads of every runtime, <= 0 keeps the OpenMP default
+    int repeat;              ///< passes over the image list
+    const char* detections_path;   ///< binary detections of every image, frame_id is its position in the list
+    bool encoded;            ///< readers only load the files, workers decode them at reduced scale
+    int cache_mb;            ///< memory cap of the result cache of every instance, 0 disables it
+};
+
+/**
+* \brief One decoded image waiting for a worker
+*/
+struct DecodedImage{
+    uint64_t index;
+    cv::Mat image;
+    std::vector<uint8_t> encoded;    ///< file contents in --encoded mode, image stays empty
+    std::chrono::steady_clock::time_point read_start;
+};
+
+static bool has_image_extension(const std::string& name) {
+    static const char* extensions[] = {".jpg", ".jpeg", ".png", ".bmp"};
+    const size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+
+    std::string extension = name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    for (const char* e : extensions) {
+        if (extension == e)
+            return true;
+    }
+    return false;
+}
+
+// every image of a directory in name order, or every non empty line of a list file
+static bool collect_images(const char* path, std::vector<std::string>* images) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Not found %s\n", path);
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(path);
+        if (dir == NULL) {
+            fprintf(stderr, "cannot open directory %s\n", path);
+            return false;
+        }
+        for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+            if (has_image_extension(entry->d_name))
+                images->push_back(std::string(path) + "/" + entry->d_name);
+        }
+        closedir(dir);
+        std::sort(images->begin(), images->end());
+    } else {
+        std::ifstream list(path);
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty())
+                images->push_back(line);
+        }
+    }
+
+    if (images->empty()) {
+        fprintf(stderr, "no images in %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>* data) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+
+    data->resize(file.tellg());
+    file.seekg(0);
+    return file.read(reinterpret_cast<char*>(data->data()), data->size()) && !data->empty();
+}
+
+static bool parse_options(int argc, char* argv[], DriverOptions* options) {
+    if (argc < 3)
+        return false;
+
+    options->model_path      = argv[1];
+    options->input_path      = argv[2];
+    options->num_readers     = 2;
+    options->num_workers     = 2;
+    options->instances       = false;
+    options->num_threads     = 0;
+    options->repeat          = 1;
+    options->detections_path = NULL;
+    options->encoded         = false;
+    options->cache_mb        = 0;
+
+    for (int i = 3; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--readers") == 0 && has_value)
+            options->num_readers = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--workers") == 0 && has_value)
+            options->num_workers = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--instances") == 0)
+            options->instances = true;
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+            options->num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && has_value)
+            options->repeat = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--detections") == 0 && has_value)
+            options->detections_path = argv[++i];
+        else if (strcmp(argv[i], "--encoded") == 0)
+            options->encoded = true;
+        else if (strcmp(argv[i], "--cache-mb") == 0 && has_value)
+            options->cache_mb = std::max(atoi(argv[++i]), 0);
+        else
+            return false;
+    }
+    return true;
+}
+
+static ModelParams make_params(const DriverOptions& options, const int num_runtimes) {
+    ModelParams yolov5_params;
+    yolov5_params.onnx_path      = options.model_path;
+    yolov5_params.num_runtimes   = num_runtimes;
+    yolov5_params.dynamic_shape  = true;
+    yolov5_params.num_threads    = options.num_threads;
+    yolov5_params.result_cache_bytes = (uint64_t)options.cache_mb << 20;
+    yolov5_params.class_agnostic = false;
+    yolov5_params.pre_nms_topk   = 30000;
+    yolov5_params.max_det        = 300;
+    return yolov5_params;
+}
+
+static double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static uint64_t elapsed_ns(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void print_histogram(const char* name, const LatencyHistogram& histogram) {
+    printf("%-12s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, (unsigned long)histogram.count(),
+           histogram.mean_us(), histogram.percentile_us(50), histogram.percentile_us(90),
+           histogram.percentile_us(99), histogram.max_us());
+}
+
+int main(int argc, char* argv[]){
+    DriverOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        fprintf(stderr, "usage: %s model.onnx <image dir | list file> [--readers R] [--workers K] [--instances] "
+                        "[--threads T] [--repeat N] [--detections out.ydet] [--encoded] [--cache-mb M]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> images;
+    if (!collect_images(options.input_path, &images))
+        return 1;
+
+    // K instances with one runtime each, or one instance whose pool of K runtimes all workers share
+    const int num_instances = options.instances ? options.num_workers : 1;
+    std::vector<std::unique_ptr<Yolov5Impl>> yolov5s;
+    for (int i = 0; i < num_instances; ++i) {
+        yolov5s.emplace_back(new Yolov5Impl(make_params(options, options.instances ? 1 : options.num_workers)));
+        if (yolov5s.back()->yolov5_network_detect_init() != ppl::common::RC_SUCCESS)
+            return 1;
+    }
+
+    DetectionWriter writer;
+    std::mutex writer_mutex;
+    if (options.detections_path && writer.open(options.detections_path, false) != ppl::common::RC_SUCCESS)
+        return 1;
+
+    // readers decode into a bounded queue, so memory stays flat whatever the size of the list
+    const uint64_t num_images = (uint64_t)images.size() * options.repeat;
+    const size_t capacity = options.num_workers * 2;
+    std::deque<DecodedImage> queue;
+    std::mutex queue_mutex;
+    std::condition_variable not_empty, not_full;
+    int num_active_readers = options.num_readers;
+    std::atomic<uint64_t> next_image(0);
+    std::atomic<uint64_t> failed(0);
+
+    LatencyHistogram read_latency, queue_latency, detect_latency, e2e_latency;
+    std::atomic<uint64_t> num_detections(0);
+
+    const double cpu_start = cpu_seconds();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < options.num_readers; ++r) {
+        threads.emplace_back([&]() {
+            for (uint64_t index = next_image++; index < num_images; index = next_image++) {
+                DecodedImage decoded;
+                decoded.index = index;
+                decoded.read_start = std::chrono::steady_clock::now();
+                const std::string& path = images[index % images.size()];
+                bool loaded = false;
+                if (options.encoded) {
+                    loaded = read_file(path, &decoded.encoded);
+                } else {
+                    decoded.image = cv::imread(path);
+                    loaded = !decoded.image.empty();
+                }
+                read_latency.record(elapsed_ns(decoded.read_start));
+                if (!loaded) {
+                    fprintf(stderr, "cannot decode %s\n", path.c_str());
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                not_full.wait(lock, [&] { return queue.size() < capacity; });
+                queue.push_back(std::move(decoded));
+                not_empty.notify_one();
+            }
+
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (--num_active_readers == 0)
+                not_empty.notify_all();
+        });
+    }
+
+    for (int w = 0; w < options.num_workers; ++w) {
+        Yolov5Impl* yolov5 = yolov5s[options.instances ? w : 0].get();
+        threads.emplace_back([&, yolov5]() {
+            Detections detections;
+            for (;;) {
+                DecodedImage decoded;
+                std::chrono::steady_clock::time_point dequeue_start = std::chrono::steady_clock::now();
+                {
+                    std::unique_lock<std::mutex> lock(queue_mutex);
+                    not_empty.wait(lock, [&] { return !queue.empty() || num_active_readers == 0; });
+                    if (queue.empty())
+                        break;
+                    decoded = std::move(queue.front());
+                    queue.pop_front();
+                    not_full.notify_one();
+                }
+                queue_latency.record(elapsed_ns(dequeue_start));
+
+                std::chrono::steady_clock::time_point detect_start = std::chrono::steady_clock::now();
+                const ppl::common::RetCode retcode = options.encoded
+                    ? yolov5->yolov5_network_detect_encoded(decoded.encoded.data(), decoded.encoded.size(), detections)
+                    : yolov5->yolov5_network_detect(decoded.image, detections);
+                if (retcode != ppl::common::RC_SUCCESS) {
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                detect_latency.record(elapsed_ns(detect_start));
+                e2e_latency.record(elapsed_ns(decoded.read_start));
+                num_detections.fetch_add(detections.size(), std::memory_order_relaxed);
+
+                if (options.detections_path) {
+                    std::lock_guard<std::mutex> lock(writer_mutex);
+                    writer.write_frame(decoded.index, detections);
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+    writer.close();
+
+    const double wall_seconds = elapsed_ns(start) * 1e-9;
+    const double busy_cores = (cpu_seconds() - cpu_start) / wall_seconds;
+    const unsigned num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+    const uint64_t processed = e2e_latency.count();
+
+    printf("%lu images (%lu failed) in %.2f s: %.1f images/s, %.2f detections/image\n",
+           (unsigned long)processed, (unsigned long)failed.load(), wall_seconds, processed / wall_seconds,
+           processed ? (double)num_detections.load() / processed : 0.0);
+    printf("cpu: %.1f of %u cores busy (%.0f%%), %d reader(s), %d worker(s), %s\n", busy_cores, num_cores,
+           100.0 * busy_cores / num_cores, options.num_readers, options.num_workers,
+           options.instances ? "one instance each" : "shared runtime pool");
+
+    printf("\n%-12s %8s %10s %10s %10s %10s %10s\n", "us", "count", "mean", "p50", "p90", "p99", "max");
+    print_histogram("read", read_latency);
+    print_histogram("queue", queue_latency);
+    print_histogram("detect", detect_latency);
+    print_histogram("end_to_end", e2e_latency);
+
+    for (int i = 0; i < num_instances; ++i) {
+        printf("\ninstance %d\n", i);
+        yolov5s[i]->get_stats().print(stdout);
+        if (options.cache_mb > 0) {
+            ResultCacheCounters cache = yolov5s[i]->get_cache_counters();
+            printf("cache hits %lu misses %lu evictions %lu entries %lu bytes %lu\n", (unsigned long)cache.hits,
+                   (unsigned long)cache.misses, (unsigned long)cache.evictions, (unsigned long)cache.entries,
+                   (unsigned long)cache.bytes);
+        }
+    }
+
+    return failed.load() ? 1 : 0;
+}
@@ -2,38 +2,49 @@
 
 #include <memory>
 #include <string>
+#include <string.h>
 
 #include <opencv2/opencv.hpp>
 
 int main(int argc, char* argv[]){
     ModelParams yolov5_params;
-    yolov5_params.yolov5_height  = 640;
-    yolov5_params.yolov5_width   = 640;
-    yolov5_params.yolov5_channel = 3;
-    yolov5_params.num_classes    = 80;
     yolov5_params.onnx_path      = argv[1];
-    
-    yolov5_params.mean[0] = 0.0f;
-    yolov5_params.mean[1] = 0.0f;
-    yolov5_params.mean[2] = 0.0f;
-    yolov5_params.std[0] = 255.0f;
-    yolov5_params.std[1] = 255.0f;
-    yolov5_params.std[2] = 255.0f;
-
+    yolov5_params.num_warmup     = 0;
     yolov5_params.prob_threshold = 0.5;
-    yolov5_params.nms_threshold  = 0.45;
+    yolov5_params.dynamic_shape  = true;
+    yolov5_params.class_agnostic = false;
+    yolov5_params.pre_nms_topk   = 30000;
+    yolov5_params.max_det        = 300;
 
 
     Yolov5Impl* yolov5 = new Yolov5Impl(yolov5_params);
     yolov5->yolov5_network_detect_init();
 
+    bool tiled = false;
+    const char* output_path = "./test.jpg";
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--tiled") == 0)
+            tiled = true;
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output_path = argv[++i];
+    }
+
     cv::Mat image = cv::imread(argv[2]);
-    cv::Mat resized_image;
-    cv::resize(image, resized_image, cv::Size(640, 640));
-    cvtColor(resized_image, resized_image, cv::COLOR_BGR2RGB);
 
     std::vector<DetectRes> detect_res;
-    yolov5->yolov5_network_detect(resized_image, detect_res);
+    if (tiled) {
+        // overlapping 640x640 tiles plus the downscaled frame, for small objects in large images
+        TileParams tile_params;
+        tile_params.tile_width          = 0;
+        tile_params.tile_height         = 0;
+        tile_params.overlap             = 128;
+        tile_params.tiles_per_batch     = 1;
+        tile_params.full_frame_pass     = true;
+        tile_params.merge_iou_threshold = 0.f;
+        yolov5->yolov5_network_detect_tiled(image, tile_params, detect_res);
+    } else {
+        yolov5->yolov5_network_detect(image, detect_res);
+    }
 
     for (size_t i = 0; i < detect_res.size(); ++i){
         // std::cout << "Here" << std::endl;
@@ -44,10 +55,11 @@ int main(int argc, char* argv[]){
         float score = detect_res[i].prob;
         int label = detect_res[i].label;
         printf("%d %d %d %d %f %d\n", x_min, y_min, x_max, y_max, score, label);
-        cv::rectangle(resized_image,cv::Rect(x_min, y_min, x_max, y_max), cv::Scalar(0,0,255),1,1,0);
+        cv::rectangle(image, cv::Rect(cv::Point(x_min, y_min), cv::Point(x_max, y_max)), cv::Scalar(0,0,255),1,1,0);
     }
 
-    cv::imwrite("./test.jpg", resized_image);
+    cv::imwrite(output_path, image);
+    yolov5->get_stats().print(stdout);
 
     return 0;
 }
\ No newline at end of file